@@ -0,0 +1,2 @@
+/* Userspace stand-in for <asm/byteorder.h>, see kshim.h */
+#include "kshim.h"
@@ -0,0 +1,732 @@
+/*
+ * kshim.h
+ *
+ * Userspace stand-ins for the kernel APIs used by Lunix:TNG,
+ * so that the driver's sources can be built and exercised as
+ * ordinary programs: benchmarks, fuzzers and stress tests.
+ *
+ * Every <linux/...> header the driver includes is a one-line
+ * file under bench/include that pulls in this one.
+ *
+ * Locks, semaphores, sleeping and timers are backed by pthreads
+ * and futexes (see kshim.c), so that the driver's own concurrency
+ * logic runs unchanged, with one thread per kernel task.
+ */
+
+#ifndef _LUNIX_KSHIM_H
+#define _LUNIX_KSHIM_H
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+/*
+ * Types
+ */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef int64_t ktime_t;
+
+#define __user
+#define __percpu
+#define __init
+#define __exit
+
+/*
+ * Helpers
+ */
+#define min(a, b)        ((a) < (b) ? (a) : (b))
+#define max(a, b)        ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)   min((t)(a), (t)(b))
+#define max_t(t, a, b)   max((t)(a), (t)(b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+#define U32_MAX          ((u32)~0U)
+#define ARRAY_SIZE(a)    (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define READ_ONCE(x)     (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_rmb()        __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()        __atomic_thread_fence(__ATOMIC_RELEASE)
+#define WARN_ON(c)       ({ int __c = !!(c); if (__c) fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #c, __FILE__, __LINE__); __c; })
+#define unlikely(x)      __builtin_expect(!!(x), 0)
+#define likely(x)        __builtin_expect(!!(x), 1)
+
+/* Type-generic, like the kernel's, unlike the one in <stdlib.h> */
+#undef abs
+#define abs(x)           ({ __typeof__(x) __x = (x); __x < 0 ? -__x : __x; })
+
+#define le16_to_cpu(x)   le16toh(x)
+#define cpu_to_le16(x)   htole16(x)
+
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline int fls64(uint64_t x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline uint64_t div_u64(uint64_t a, uint32_t b)
+{
+	return a / b;
+}
+
+static inline uint64_t div64_u64(uint64_t a, uint64_t b)
+{
+	return a / b;
+}
+
+static inline uint64_t div_u64_rem(uint64_t a, uint32_t b, uint32_t *rem)
+{
+	*rem = a % b;
+	return a / b;
+}
+
+static inline int64_t div_s64(int64_t a, int32_t b)
+{
+	return a / b;
+}
+
+static inline int64_t div64_s64(int64_t a, int64_t b)
+{
+	return a / b;
+}
+
+static inline uint64_t mul_u64_u64_div_u64(uint64_t a, uint64_t b, uint64_t c)
+{
+	return (unsigned __int128)a * b / c;
+}
+
+static inline uint32_t int_sqrt64(uint64_t x)
+{
+	uint64_t r = 0, bit;
+
+	for (bit = 1ULL << 62; bit; bit >>= 2) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+	}
+	return r;
+}
+
+/*
+ * Logging: silent unless lunix_shim_verbose is set
+ */
+extern int lunix_shim_verbose;
+void lunix_shim_printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define KERN_ERR         ""
+#define KERN_WARNING     ""
+#define KERN_INFO        ""
+#define KERN_DEBUG       ""
+#define KERN_CONT        ""
+#define printk(fmt, ...)             lunix_shim_printk(fmt, ##__VA_ARGS__)
+#define printk_ratelimited(fmt, ...) lunix_shim_printk(fmt, ##__VA_ARGS__)
+
+/*
+ * Modules
+ */
+#define THIS_MODULE NULL
+#define module_param(name, type, perm) \
+	static const void *__lunix_shim_param_##name __attribute__((unused)) = &name
+#define module_param_array(name, type, nump, perm) \
+	static const void *__lunix_shim_param_##name __attribute__((unused)) = &name
+#define MODULE_PARM_DESC(name, desc) \
+	static const char __lunix_shim_desc_##name[] __attribute__((unused)) = desc
+#define EXPORT_SYMBOL_GPL(sym)
+
+/*
+ * Per-CPU data: a single copy, updated atomically
+ */
+#define DECLARE_PER_CPU(type, name)  extern __typeof__(type) name
+#define DEFINE_PER_CPU(type, name)   __typeof__(type) name
+#define this_cpu_add(x, n)           __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define this_cpu_inc(x)              this_cpu_add(x, 1)
+
+/*
+ * Static keys, as plain flags
+ */
+struct static_key_false {
+	int enabled;
+};
+#define DECLARE_STATIC_KEY_FALSE(name)  extern struct static_key_false name
+#define DEFINE_STATIC_KEY_FALSE(name)   struct static_key_false name = { 0 }
+#define static_branch_unlikely(key)     unlikely(READ_ONCE((key)->enabled))
+#define static_branch_enable(key)       WRITE_ONCE((key)->enabled, 1)
+#define static_branch_disable(key)      WRITE_ONCE((key)->enabled, 0)
+
+/*
+ * Time. Jiffies tick at 1 kHz, off the monotonic clock.
+ */
+#define HZ 1000
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ktime_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t ktime_get_real_seconds(void)
+{
+	return time(NULL);
+}
+
+#define ktime_sub(a, b)   ((a) - (b))
+#define ktime_to_ns(t)    (t)
+#define ktime_after(a, b) ((a) > (b))
+#define us_to_ktime(us)   ((ktime_t)(us) * 1000)
+
+#define jiffies                  ((unsigned long)(ktime_get() / (1000000000 / HZ)))
+#define get_jiffies_64()         ((u64)(ktime_get() / (1000000000 / HZ)))
+#define time_after(a, b)         ((long)((b) - (a)) < 0)
+#define time_before(a, b)        time_after(b, a)
+#define time_after_eq(a, b)      ((long)((a) - (b)) >= 0)
+#define msecs_to_jiffies(m)      ((unsigned long)(m) * HZ / 1000)
+#define jiffies_to_msecs(j)      ((unsigned int)((j) * 1000 / HZ))
+
+/*
+ * Tracepoints compile to empty inline functions
+ */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...)  args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+
+/*
+ * debugfs
+ */
+struct dentry;
+
+/*
+ * Lists, as in <linux/list.h>
+ */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return READ_ONCE(head->next) == head;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	head->next->prev = new;
+	head->next = new;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->prev = head->prev;
+	new->next = head;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	INIT_LIST_HEAD(entry);
+}
+
+/*
+ * Bit operations, atomic as in the kernel
+ */
+#define BITS_PER_LONG     (8 * sizeof(long))
+#define BITS_TO_LONGS(n)  (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)      ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)      (1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(long nr, unsigned long *addr)
+{
+	__atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+
+static inline void clear_bit(long nr, unsigned long *addr)
+{
+	__atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+
+static inline bool test_bit(long nr, const unsigned long *addr)
+{
+	return __atomic_load_n(&addr[BIT_WORD(nr)], __ATOMIC_RELAXED) & BIT_MASK(nr);
+}
+
+static inline bool test_and_set_bit(long nr, unsigned long *addr)
+{
+	return __atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_SEQ_CST) & BIT_MASK(nr);
+}
+
+static inline bool test_and_clear_bit(long nr, unsigned long *addr)
+{
+	return __atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_SEQ_CST) & BIT_MASK(nr);
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+                                          unsigned long offset)
+{
+	for (; offset < size; offset++)
+		if (READ_ONCE(addr[BIT_WORD(offset)]) & BIT_MASK(offset))
+			break;
+
+	return min(offset, size);
+}
+
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = find_next_bit((addr), (size), 0); \
+	     (bit) < (size); \
+	     (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+/*
+ * Memory: pages are page-aligned heap blocks
+ */
+#define GFP_KERNEL  0
+#define GFP_ATOMIC  0
+#define PAGE_SIZE   4096UL
+
+#define kmalloc(size, gfp)       malloc(size)
+#define kzalloc(size, gfp)       calloc(1, size)
+#define kcalloc(n, size, gfp)    calloc(n, size)
+#define kfree(p)                 free(p)
+#define bitmap_zalloc(n, gfp)    ((unsigned long *)calloc(BITS_TO_LONGS(n), sizeof(long)))
+#define bitmap_free(p)           free(p)
+
+static inline unsigned long get_zeroed_page(int gfp)
+{
+	void *p = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+	if (p)
+		memset(p, 0, PAGE_SIZE);
+	return (unsigned long)p;
+}
+
+static inline void free_page(unsigned long addr)
+{
+	free((void *)addr);
+}
+
+/*
+ * Mappings: there is nothing to map into, pages are their addresses
+ */
+#define VM_WRITE    0x00000002UL
+#define VM_MAYWRITE 0x00000020UL
+
+struct page;
+
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_pgoff;
+	unsigned long vm_flags;
+};
+
+#define virt_to_page(addr) ((struct page *)(addr))
+
+static inline void vm_flags_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+	vma->vm_flags &= ~flags;
+}
+
+static inline int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, struct page *page)
+{
+	return -ENOSYS;
+}
+
+/*
+ * Userspace is the same address space
+ */
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+#define ERR_PTR(err)       ((void *)(long)(err))
+#define PTR_ERR(ptr)       ((long)(ptr))
+#define IS_ERR(ptr)        ((unsigned long)(ptr) >= (unsigned long)-4095)
+
+static inline void *memdup_user(const void __user *src, size_t len)
+{
+	void *p = malloc(len);
+
+	if (!p)
+		return ERR_PTR(-ENOMEM);
+	memcpy(p, src, len);
+	return p;
+}
+
+/*
+ * Nothing here is privileged
+ */
+#define CAP_SYS_ADMIN 21
+#define capable(cap)  (1)
+
+/*
+ * Spinlocks are pthread mutexes: with hundreds of threads on a few
+ * CPUs, busy-waiting on a preempted lock holder would dominate.
+ */
+typedef struct {
+	pthread_mutex_t m;
+} spinlock_t;
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	pthread_mutex_lock(&lock->m);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	pthread_mutex_unlock(&lock->m);
+}
+
+#define spin_lock_irq(lock)               spin_lock(lock)
+#define spin_unlock_irq(lock)             spin_unlock(lock)
+#define spin_lock_irqsave(lock, flags)    do { (flags) = 0; spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, flags) do { (void)(flags); spin_unlock(lock); } while (0)
+#define spin_lock_bh(lock)                spin_lock(lock)
+#define spin_unlock_bh(lock)              spin_unlock(lock)
+
+/*
+ * Counting semaphores on a futex
+ */
+struct semaphore {
+	int count;
+};
+
+static inline void sema_init(struct semaphore *sem, int val)
+{
+	sem->count = val;
+}
+
+void down(struct semaphore *sem);
+void up(struct semaphore *sem);
+
+/* Signals never interrupt taking the semaphore */
+static inline int down_interruptible(struct semaphore *sem)
+{
+	down(sem);
+	return 0;
+}
+
+/*
+ * Tasks: every thread is one, sleeping on a futex on its state
+ */
+#define TASK_RUNNING          0
+#define TASK_INTERRUPTIBLE    1
+#define MAX_SCHEDULE_TIMEOUT  LONG_MAX
+#define ERESTARTSYS           512
+
+struct task_struct {
+	int state;
+	int sigpending;
+};
+
+extern __thread struct task_struct lunix_shim_task;
+#define current (&lunix_shim_task)
+
+static inline int signal_pending(struct task_struct *p)
+{
+	return READ_ONCE(p->sigpending);
+}
+
+#define set_current_state(s)  __atomic_store_n(&current->state, (s), __ATOMIC_SEQ_CST)
+#define __set_current_state(s) WRITE_ONCE(current->state, (s))
+
+long schedule_timeout(long timeout);
+int wake_up_process(struct task_struct *p);
+
+/*
+ * Makes a signal pending on a task and kicks it out of any sleep,
+ * as signal_wake_up() would.
+ */
+void lunix_shim_kill(struct task_struct *p);
+
+/*
+ * Wait queues, as in kernel/sched/wait.c
+ */
+#define WQ_FLAG_EXCLUSIVE 0x01
+
+struct wait_queue_entry;
+typedef int (*wait_queue_func_t)(struct wait_queue_entry *wq_entry, unsigned int mode,
+                                 int flags, void *key);
+
+struct wait_queue_entry {
+	unsigned int flags;
+	void *private;
+	wait_queue_func_t func;
+	struct list_head entry;
+};
+
+typedef struct wait_queue_head {
+	spinlock_t lock;
+	struct list_head head;
+} wait_queue_head_t;
+
+void init_waitqueue_head(wait_queue_head_t *wq_head);
+void init_wait_entry(struct wait_queue_entry *wq_entry, int flags);
+void add_wait_queue(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry);
+void remove_wait_queue(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry);
+void prepare_to_wait(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry, int state);
+void finish_wait(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry);
+int default_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode, int flags, void *key);
+int autoremove_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode, int flags, void *key);
+void __wake_up(wait_queue_head_t *wq_head, unsigned int mode, int nr_exclusive, void *key);
+
+#define wake_up_interruptible(wq)     __wake_up(wq, TASK_INTERRUPTIBLE, 1, NULL)
+#define wake_up_interruptible_all(wq) __wake_up(wq, TASK_INTERRUPTIBLE, 0, NULL)
+#define wake_up(wq)                   __wake_up(wq, TASK_INTERRUPTIBLE, 1, NULL)
+#define wake_up_all(wq)               __wake_up(wq, TASK_INTERRUPTIBLE, 0, NULL)
+
+static inline void init_waitqueue_func_entry(struct wait_queue_entry *wq_entry, wait_queue_func_t func)
+{
+	wq_entry->flags = 0;
+	wq_entry->private = NULL;
+	wq_entry->func = func;
+}
+
+static inline void __add_wait_queue(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry)
+{
+	list_add(&wq_entry->entry, &wq_head->head);
+}
+
+/*
+ * Timers, all run by a single timer thread
+ */
+struct lunix_shim_timer {
+	struct list_head node;
+	ktime_t expires;
+	void (*run)(struct lunix_shim_timer *shim);
+};
+
+struct timer_list {
+	struct lunix_shim_timer shim;
+	void (*function)(struct timer_list *timer);
+};
+
+#define from_timer(var, timer, field) container_of(timer, __typeof__(*var), field)
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), unsigned int flags);
+int mod_timer(struct timer_list *timer, unsigned long expires);
+int timer_pending(const struct timer_list *timer);
+int timer_delete_sync(struct timer_list *timer);
+
+/*
+ * Delayed work, run by the timer thread, which is as good a process
+ * context as any here
+ */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+};
+
+struct delayed_work {
+	struct work_struct work;
+	struct timer_list timer;
+	unsigned long pending;
+	bool canceled;
+};
+
+#define INIT_DELAYED_WORK(dwork, fn)    init_delayed_work(dwork, fn)
+#define INIT_DEFERRABLE_WORK(dwork, fn) init_delayed_work(dwork, fn)
+
+void init_delayed_work(struct delayed_work *dwork, work_func_t func);
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_REL,
+	HRTIMER_MODE_REL_SOFT,
+};
+
+struct hrtimer {
+	struct lunix_shim_timer shim;
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+};
+
+void hrtimer_init(struct hrtimer *timer, clockid_t clock_id, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+
+/*
+ * Files and character devices: just enough for the harness to
+ * call the file operations of a device directly
+ */
+typedef unsigned int __poll_t;
+typedef struct poll_table_struct poll_table;
+
+#define EPOLLIN     0x00000001
+#define EPOLLPRI    0x00000002
+#define EPOLLERR    0x00000008
+#define EPOLLHUP    0x00000010
+#define EPOLLRDNORM 0x00000040
+
+#define MINORBITS        20
+#define MINORMASK        ((1U << MINORBITS) - 1)
+#define MKDEV(ma, mi)    (((ma) << MINORBITS) | (mi))
+#define MAJOR(dev)       ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev)       ((unsigned int)((dev) & MINORMASK))
+
+struct module;
+
+struct inode {
+	dev_t i_rdev;
+};
+
+struct file {
+	unsigned int f_flags;
+	loff_t f_pos;
+	void *private_data;
+	const struct file_operations *f_op;
+};
+
+/*
+ * I/O requests, with a single flat buffer per iterator
+ */
+#define IOCB_NOWAIT (1 << 7)
+
+struct kiocb {
+	struct file *ki_filp;
+	loff_t ki_pos;
+	int ki_flags;
+};
+
+struct iov_iter {
+	char *buf;
+	size_t count;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, i->count);
+	memcpy(i->buf, addr, bytes);
+	i->buf += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+struct file_operations {
+	struct module *owner;
+	int (*open)(struct inode *inode, struct file *filp);
+	int (*release)(struct inode *inode, struct file *filp);
+	ssize_t (*read)(struct file *filp, char __user *buf, size_t cnt, loff_t *f_pos);
+	ssize_t (*read_iter)(struct kiocb *iocb, struct iov_iter *to);
+	__poll_t (*poll)(struct file *filp, poll_table *wait);
+	long (*unlocked_ioctl)(struct file *filp, unsigned int cmd, unsigned long arg);
+	long (*compat_ioctl)(struct file *filp, unsigned int cmd, unsigned long arg);
+	int (*mmap)(struct file *filp, struct vm_area_struct *vma);
+};
+
+struct cdev {
+	struct module *owner;
+	const struct file_operations *ops;
+	dev_t dev;
+	unsigned int count;
+};
+
+static inline unsigned int iminor(const struct inode *inode)
+{
+	return MINOR(inode->i_rdev);
+}
+
+static inline int nonseekable_open(struct inode *inode, struct file *filp)
+{
+	return 0;
+}
+
+/* Nobody polls in the harness */
+static inline void poll_wait(struct file *filp, wait_queue_head_t *wq_head, poll_table *p)
+{
+}
+
+static inline long compat_ptr_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	return filp->f_op->unlocked_ioctl(filp, cmd, arg);
+}
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+	memset(cdev, 0, sizeof(*cdev));
+	cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+	cdev->dev = dev;
+	cdev->count = count;
+	return 0;
+}
+
+static inline void cdev_del(struct cdev *cdev)
+{
+}
+
+static inline int register_chrdev_region(dev_t from, unsigned int count, const char *name)
+{
+	return 0;
+}
+
+static inline void unregister_chrdev_region(dev_t from, unsigned int count)
+{
+}
+
+/*
+ * CRC-16/CCITT as in lib/crc-itu-t.c
+ */
+uint16_t crc_itu_t(uint16_t crc, const uint8_t *buffer, size_t len);
+
+#endif /* _LUNIX_KSHIM_H */
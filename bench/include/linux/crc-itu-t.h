@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/crc-itu-t.h>, see kshim.h */
+#include "kshim.h"
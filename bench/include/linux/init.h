@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/init.h>, see kshim.h */
+#include "kshim.h"
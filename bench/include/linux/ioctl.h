@@ -0,0 +1,3 @@
+/* Userspace stand-in for <linux/ioctl.h>, see kshim.h */
+#include <asm/ioctl.h>
+#include "kshim.h"
@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/jump_label.h>, see kshim.h */
+#include "kshim.h"
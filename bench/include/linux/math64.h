@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/math64.h>, see kshim.h */
+#include "kshim.h"
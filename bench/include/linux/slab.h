@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/slab.h>, see kshim.h */
+#include "kshim.h"
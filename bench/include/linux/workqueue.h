@@ -0,0 +1,2 @@
+/* Userspace stand-in for <linux/workqueue.h>, see kshim.h */
+#include "kshim.h"
@@ -0,0 +1,465 @@
+/*
+ * kshim.c
+ *
+ * Userspace implementations of the kernel APIs declared
+ * in kshim.h, and the global state of lunix-stats.c.
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "kshim.h"
+
+#include "lunix.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+#include "lunix-ldisc.h"
+
+int lunix_shim_verbose;
+
+void lunix_shim_printk(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!lunix_shim_verbose)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+uint16_t crc_itu_t(uint16_t crc, const uint8_t *buffer, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buffer++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+/*
+ * Futexes. <linux/futex.h> would pick up the stand-in <linux/types.h>,
+ * so the few constants needed are spelled out here.
+ */
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_PRIVATE_FLAG  128
+
+static long futex(int *uaddr, int op, int val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, op | FUTEX_PRIVATE_FLAG, val, timeout, NULL, 0);
+}
+
+/*
+ * Semaphores
+ */
+void down(struct semaphore *sem)
+{
+	int count;
+
+	for (;;) {
+		count = __atomic_load_n(&sem->count, __ATOMIC_ACQUIRE);
+		if (count > 0) {
+			if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, false,
+			                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return;
+			continue;
+		}
+		futex(&sem->count, FUTEX_WAIT, count, NULL);
+	}
+}
+
+void up(struct semaphore *sem)
+{
+	__atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE);
+	futex(&sem->count, FUTEX_WAKE, 1, NULL);
+}
+
+/*
+ * Tasks sleep until someone sets their state back to TASK_RUNNING.
+ * The futex checks the state atomically against the one the task went
+ * to sleep in, so a wakeup racing with schedule_timeout() is not lost.
+ */
+__thread struct task_struct lunix_shim_task;
+
+long schedule_timeout(long timeout)
+{
+	ktime_t deadline = 0, left;
+	struct timespec ts, *tsp = NULL;
+	int state;
+
+	if (timeout != MAX_SCHEDULE_TIMEOUT)
+		deadline = ktime_get() + timeout * (1000000000 / HZ);
+
+	while ((state = __atomic_load_n(&current->state, __ATOMIC_ACQUIRE)) != TASK_RUNNING) {
+		if (deadline) {
+			left = deadline - ktime_get();
+			if (left <= 0)
+				break;
+			ts.tv_sec = left / 1000000000;
+			ts.tv_nsec = left % 1000000000;
+			tsp = &ts;
+		}
+		futex(&current->state, FUTEX_WAIT, state, tsp);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	if (!deadline)
+		return MAX_SCHEDULE_TIMEOUT;
+
+	left = deadline - ktime_get();
+	return left > 0 ? left / (1000000000 / HZ) : 0;
+}
+
+int wake_up_process(struct task_struct *p)
+{
+	if (__atomic_exchange_n(&p->state, TASK_RUNNING, __ATOMIC_SEQ_CST) == TASK_RUNNING)
+		return 0;
+
+	futex(&p->state, FUTEX_WAKE, 1, NULL);
+	return 1;
+}
+
+void lunix_shim_kill(struct task_struct *p)
+{
+	__atomic_store_n(&p->sigpending, 1, __ATOMIC_SEQ_CST);
+	wake_up_process(p);
+}
+
+/*
+ * Wait queues
+ */
+void init_waitqueue_head(wait_queue_head_t *wq_head)
+{
+	spin_lock_init(&wq_head->lock);
+	INIT_LIST_HEAD(&wq_head->head);
+}
+
+void init_wait_entry(struct wait_queue_entry *wq_entry, int flags)
+{
+	wq_entry->flags = flags;
+	wq_entry->private = current;
+	wq_entry->func = autoremove_wake_function;
+	INIT_LIST_HEAD(&wq_entry->entry);
+}
+
+void add_wait_queue(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry)
+{
+	spin_lock(&wq_head->lock);
+	list_add_tail(&wq_entry->entry, &wq_head->head);
+	spin_unlock(&wq_head->lock);
+}
+
+void remove_wait_queue(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry)
+{
+	spin_lock(&wq_head->lock);
+	list_del_init(&wq_entry->entry);
+	spin_unlock(&wq_head->lock);
+}
+
+void prepare_to_wait(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry, int state)
+{
+	spin_lock(&wq_head->lock);
+	if (list_empty(&wq_entry->entry))
+		list_add_tail(&wq_entry->entry, &wq_head->head);
+	set_current_state(state);
+	spin_unlock(&wq_head->lock);
+}
+
+void finish_wait(wait_queue_head_t *wq_head, struct wait_queue_entry *wq_entry)
+{
+	__set_current_state(TASK_RUNNING);
+
+	spin_lock(&wq_head->lock);
+	if (!list_empty(&wq_entry->entry))
+		list_del_init(&wq_entry->entry);
+	spin_unlock(&wq_head->lock);
+}
+
+int default_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode, int flags, void *key)
+{
+	return wake_up_process(wq_entry->private);
+}
+
+int autoremove_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode, int flags, void *key)
+{
+	int ret = default_wake_function(wq_entry, mode, flags, key);
+
+	if (ret)
+		list_del_init(&wq_entry->entry);
+	return ret;
+}
+
+void __wake_up(wait_queue_head_t *wq_head, unsigned int mode, int nr_exclusive, void *key)
+{
+	struct wait_queue_entry *curr;
+	struct list_head *pos, *next;
+	int ret;
+
+	spin_lock(&wq_head->lock);
+	for (pos = wq_head->head.next; pos != &wq_head->head; pos = next) {
+		next = pos->next;
+		curr = container_of(pos, struct wait_queue_entry, entry);
+		ret = curr->func(curr, mode, 0, key);
+		if (ret < 0)
+			break;
+		if (ret && (curr->flags & WQ_FLAG_EXCLUSIVE) && !--nr_exclusive)
+			break;
+	}
+	spin_unlock(&wq_head->lock);
+}
+
+/*
+ * Timers: armed timers sit on a list, which a single thread scans
+ * for the earliest expiry. Callbacks run on that thread, without
+ * the list lock held, so they may re-arm their own timer.
+ */
+static pthread_mutex_t lunix_shim_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lunix_shim_timer_cond = PTHREAD_COND_INITIALIZER;
+static struct list_head lunix_shim_timers = { &lunix_shim_timers, &lunix_shim_timers };
+static struct lunix_shim_timer *lunix_shim_timer_running;
+static pthread_once_t lunix_shim_timer_once = PTHREAD_ONCE_INIT;
+
+static void *lunix_shim_timer_thread(void *arg)
+{
+	struct lunix_shim_timer *t, *first;
+	struct list_head *pos;
+	struct timespec ts;
+
+	pthread_mutex_lock(&lunix_shim_timer_lock);
+	for (;;) {
+		first = NULL;
+		for (pos = lunix_shim_timers.next; pos != &lunix_shim_timers; pos = pos->next) {
+			t = container_of(pos, struct lunix_shim_timer, node);
+			if (!first || t->expires < first->expires)
+				first = t;
+		}
+
+		if (!first) {
+			pthread_cond_wait(&lunix_shim_timer_cond, &lunix_shim_timer_lock);
+			continue;
+		}
+		if (first->expires > ktime_get()) {
+			ts.tv_sec = first->expires / 1000000000;
+			ts.tv_nsec = first->expires % 1000000000;
+			pthread_cond_timedwait(&lunix_shim_timer_cond, &lunix_shim_timer_lock, &ts);
+			continue;
+		}
+
+		list_del_init(&first->node);
+		lunix_shim_timer_running = first;
+		pthread_mutex_unlock(&lunix_shim_timer_lock);
+		first->run(first);
+		pthread_mutex_lock(&lunix_shim_timer_lock);
+		lunix_shim_timer_running = NULL;
+		pthread_cond_broadcast(&lunix_shim_timer_cond);
+	}
+
+	return NULL;
+}
+
+static void lunix_shim_timer_start(void)
+{
+	pthread_condattr_t attr;
+	pthread_t thread;
+
+	/* Expiry times are CLOCK_MONOTONIC, like ktime_get() */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&lunix_shim_timer_cond, &attr);
+
+	if (pthread_create(&thread, NULL, lunix_shim_timer_thread, NULL)) {
+		perror("pthread_create");
+		abort();
+	}
+	pthread_detach(thread);
+}
+
+static int lunix_shim_timer_arm(struct lunix_shim_timer *t, ktime_t expires)
+{
+	int pending;
+
+	pthread_once(&lunix_shim_timer_once, lunix_shim_timer_start);
+
+	pthread_mutex_lock(&lunix_shim_timer_lock);
+	pending = !list_empty(&t->node);
+	if (!pending)
+		list_add_tail(&t->node, &lunix_shim_timers);
+	t->expires = expires;
+	pthread_cond_broadcast(&lunix_shim_timer_cond);
+	pthread_mutex_unlock(&lunix_shim_timer_lock);
+
+	return pending;
+}
+
+static int lunix_shim_timer_cancel(struct lunix_shim_timer *t)
+{
+	int pending;
+
+	pthread_mutex_lock(&lunix_shim_timer_lock);
+	pending = !list_empty(&t->node);
+	if (pending)
+		list_del_init(&t->node);
+	while (lunix_shim_timer_running == t)
+		pthread_cond_wait(&lunix_shim_timer_cond, &lunix_shim_timer_lock);
+	pthread_mutex_unlock(&lunix_shim_timer_lock);
+
+	return pending;
+}
+
+static void lunix_shim_timer_list_run(struct lunix_shim_timer *shim)
+{
+	struct timer_list *timer = container_of(shim, struct timer_list, shim);
+
+	timer->function(timer);
+}
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), unsigned int flags)
+{
+	INIT_LIST_HEAD(&timer->shim.node);
+	timer->shim.run = lunix_shim_timer_list_run;
+	timer->function = function;
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+	long delta = expires - jiffies;
+
+	return lunix_shim_timer_arm(&timer->shim, ktime_get() + max(delta, 0L) * (1000000000 / HZ));
+}
+
+int timer_pending(const struct timer_list *timer)
+{
+	int pending;
+
+	pthread_mutex_lock(&lunix_shim_timer_lock);
+	pending = !list_empty(&timer->shim.node);
+	pthread_mutex_unlock(&lunix_shim_timer_lock);
+
+	return pending;
+}
+
+int timer_delete_sync(struct timer_list *timer)
+{
+	return lunix_shim_timer_cancel(&timer->shim);
+}
+
+static void lunix_shim_delayed_work_run(struct timer_list *timer)
+{
+	struct delayed_work *dwork = from_timer(dwork, timer, timer);
+
+	clear_bit(0, &dwork->pending);
+	dwork->work.func(&dwork->work);
+}
+
+void init_delayed_work(struct delayed_work *dwork, work_func_t func)
+{
+	dwork->work.func = func;
+	dwork->pending = 0;
+	dwork->canceled = false;
+	timer_setup(&dwork->timer, lunix_shim_delayed_work_run, 0);
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	if (__atomic_load_n(&dwork->canceled, __ATOMIC_SEQ_CST) || test_and_set_bit(0, &dwork->pending))
+		return false;
+
+	mod_timer(&dwork->timer, jiffies + delay);
+	return true;
+}
+
+/* Work that schedules itself again is not let to, once canceled */
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	__atomic_store_n(&dwork->canceled, true, __ATOMIC_SEQ_CST);
+	return timer_delete_sync(&dwork->timer) | timer_delete_sync(&dwork->timer);
+}
+
+static void lunix_shim_hrtimer_run(struct lunix_shim_timer *shim)
+{
+	struct hrtimer *timer = container_of(shim, struct hrtimer, shim);
+
+	/* Restarting would need hrtimer_forward(), which nobody uses */
+	timer->function(timer);
+}
+
+void hrtimer_init(struct hrtimer *timer, clockid_t clock_id, enum hrtimer_mode mode)
+{
+	INIT_LIST_HEAD(&timer->shim.node);
+	timer->shim.run = lunix_shim_hrtimer_run;
+	timer->function = NULL;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+	lunix_shim_timer_arm(&timer->shim, ktime_get() + tim);
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	return lunix_shim_timer_cancel(&timer->shim);
+}
+
+/*
+ * Counters normally defined in lunix-stats.c
+ */
+DEFINE_PER_CPU(struct lunix_stats_struct, lunix_stats);
+DEFINE_PER_CPU(struct lunix_latency_struct, lunix_latency);
+DEFINE_STATIC_KEY_FALSE(lunix_latency_key);
+u64 __percpu *lunix_stats_node_updates;
+struct dentry *lunix_debugfs_dir;
+
+/*
+ * The traffic taps normally defined in lunix-tap.c,
+ * which nothing opens here
+ */
+DEFINE_STATIC_KEY_FALSE(lunix_tap_raw_key);
+DEFINE_STATIC_KEY_FALSE(lunix_tap_frame_key);
+
+void __lunix_tap_raw(const unsigned char *buf, int count)
+{
+}
+
+void __lunix_tap_frame(const unsigned char *packet, int len, int crc_ok)
+{
+}
+
+/*
+ * Normally in lunix-ldisc.c: there is no TTY to send commands through
+ */
+int lunix_ldisc_xcommand(int node, u16 cmd, u32 arg)
+{
+	return -ENODEV;
+}
+
+u64 lunix_stat_read(enum lunix_stat_enum item)
+{
+	return __atomic_load_n(&lunix_stats.cnt[item], __ATOMIC_RELAXED);
+}
+
+u64 lunix_stat_read_node(int sensor_num)
+{
+	return __atomic_load_n(&lunix_stats_node_updates[sensor_num], __ATOMIC_RELAXED);
+}
+
+/*
+ * Only the per-node counters need setting up,
+ * there is no sysfs or debugfs to register with.
+ */
+int lunix_stats_init(void)
+{
+	lunix_stats_node_updates = calloc(lunix_sensor_cnt, sizeof(u64));
+	return lunix_stats_node_updates ? 0 : -ENOMEM;
+}
+
+void lunix_stats_destroy(void)
+{
+	free(lunix_stats_node_updates);
+	lunix_stats_node_updates = NULL;
+}
@@ -0,0 +1,381 @@
+/*
+ * lunix-chrdev-bench.c
+ *
+ * Concurrency scaling benchmark for the Lunix:TNG character
+ * device and sensor buffers, built in userspace against the
+ * shims in kshim.h.
+ *
+ * Runs the real lunix-chrdev.c and lunix-sensors.c: a producer
+ * thread updates every sensor at a fixed rate, as the line
+ * discipline would, while a growing number of reader threads
+ * block in lunix_chrdev_read() on the sensors' wait queues.
+ * For each reader count, it reports read throughput and the
+ * wakeup latencies collected by the driver's own histograms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kshim.h"
+#include "lunix.h"
+#include "lunix-chrdev.h"
+#include "lunix-stats.h"
+
+/*
+ * Global state normally living in lunix-module.c
+ */
+int lunix_sensor_cnt = LUNIX_SENSOR_CNT;
+struct lunix_sensor_struct *lunix_sensors;
+
+extern struct cdev lunix_chrdev_cdev;
+
+struct reader {
+	pthread_t thread;
+	unsigned int minor;
+	struct task_struct *task;
+	unsigned long reads;
+	unsigned long bytes;
+	int ret;
+};
+
+static pthread_barrier_t start_barrier;
+
+/*
+ * Reads from a file, as read(2) would through new_sync_read()
+ */
+static ssize_t file_read(struct file *filp, char *buf, size_t cnt)
+{
+	struct kiocb iocb = { .ki_filp = filp, .ki_pos = filp->f_pos };
+	struct iov_iter to = { .buf = buf, .count = cnt };
+	ssize_t ret;
+
+	ret = filp->f_op->read_iter(&iocb, &to);
+	filp->f_pos = iocb.ki_pos;
+	return ret;
+}
+
+/*
+ * A reader thread: opens its device node and reads
+ * from it until the harness makes a signal pending.
+ */
+static void *reader_fn(void *arg)
+{
+	const struct file_operations *fops = lunix_chrdev_cdev.ops;
+	struct reader *r = arg;
+	struct inode inode = { .i_rdev = MKDEV(LUNIX_CHRDEV_MAJOR, r->minor) };
+	struct file filp = { .f_op = fops };
+	char buf[64];
+	ssize_t n;
+
+	r->task = current;
+	r->ret = fops->open(&inode, &filp);
+	pthread_barrier_wait(&start_barrier);
+	if (r->ret < 0)
+		return NULL;
+
+	while ((n = file_read(&filp, buf, sizeof(buf))) >= 0) {
+		r->reads++;
+		r->bytes += n;
+	}
+	if (n != -ERESTARTSYS)
+		r->ret = n;
+
+	fops->release(&inode, &filp);
+	return NULL;
+}
+
+/*
+ * Publishes a single sample of every measurement of sensor 0
+ */
+static void publish_one(void)
+{
+	lunix_sensor_update(&lunix_sensors[0], 1, 2, 3, lunix_latency_now());
+	lunix_sensor_wake_flush();
+}
+
+/*
+ * A batching reader for the watermark check: opens the temperature
+ * of sensor 0 with a watermark of 4 samples or 50 ms, and times one
+ * read, blocking from before the first sample arrives.
+ */
+static struct lunix_ioc_watermark wm_check = { .count = 4, .timeout_ms = 50 };
+
+struct wm_reader {
+	pthread_t thread;
+	struct task_struct *task;
+	ktime_t done;
+	ssize_t ret;
+};
+
+static void *wm_reader_fn(void *arg)
+{
+	const struct file_operations *fops = lunix_chrdev_cdev.ops;
+	struct wm_reader *r = arg;
+	struct inode inode = { .i_rdev = MKDEV(LUNIX_CHRDEV_MAJOR, TEMP) };
+	struct file filp = { .f_op = fops };
+	char buf[64];
+	ssize_t ret;
+
+	r->task = current;
+	ret = fops->open(&inode, &filp);
+	if (ret == 0)
+		ret = fops->unlocked_ioctl(&filp, LUNIX_IOC_SET_WATERMARK, (unsigned long)&wm_check);
+	pthread_barrier_wait(&start_barrier);
+	if (ret < 0) {
+		r->ret = ret;
+		return NULL;
+	}
+
+	r->ret = file_read(&filp, buf, sizeof(buf));
+	WRITE_ONCE(r->done, ktime_get());
+
+	fops->release(&inode, &filp);
+	return NULL;
+}
+
+/*
+ * Checks that a watermark's timeout holds when the first sample of a
+ * batch arrives after the reader went to sleep, for blocking reads and
+ * for pollers alike. Returns 0 if it does, -1 otherwise.
+ */
+static int check_watermark(void)
+{
+	const struct file_operations *fops = lunix_chrdev_cdev.ops;
+	struct inode inode = { .i_rdev = MKDEV(LUNIX_CHRDEV_MAJOR, TEMP) };
+	struct file filp = { .f_op = fops };
+	struct lunix_chrdev_state_struct *state;
+	struct wm_reader r = { 0 };
+	ktime_t published;
+	int ret = 0;
+
+	/* Blocking read: the sample comes once the reader is asleep */
+	pthread_barrier_init(&start_barrier, NULL, 2);
+	if (pthread_create(&r.thread, NULL, wm_reader_fn, &r)) {
+		perror("pthread_create");
+		exit(1);
+	}
+	pthread_barrier_wait(&start_barrier);
+	usleep(20000);
+	published = ktime_get();
+	publish_one();
+	usleep(500000);
+	if (!READ_ONCE(r.done)) {
+		fprintf(stderr, "watermark: read still blocked 500 ms after a sample, "
+		        "timeout %u ms\n", wm_check.timeout_ms);
+		lunix_shim_kill(r.task);
+		ret = -1;
+	} else if (r.ret <= 0) {
+		fprintf(stderr, "watermark: read failed with %zd\n", r.ret);
+		ret = -1;
+	} else {
+		printf("watermark: one sample delivered %.1f ms after it arrived, timeout %u ms\n",
+		       (r.done - published) / 1e6, wm_check.timeout_ms);
+	}
+	pthread_join(r.thread, NULL);
+	pthread_barrier_destroy(&start_barrier);
+
+	/* Poll: the sample must arm the timer that wakes the poller */
+	if (fops->open(&inode, &filp) < 0 ||
+	    fops->unlocked_ioctl(&filp, LUNIX_IOC_SET_WATERMARK, (unsigned long)&wm_check) < 0) {
+		fprintf(stderr, "watermark: cannot open the poller's file\n");
+		return -1;
+	}
+	state = filp.private_data;
+	if (fops->poll(&filp, NULL) != 0) {
+		fprintf(stderr, "watermark: poll ready with nothing pending\n");
+		ret = -1;
+	}
+	publish_one();
+	if (!timer_pending(&state->poll_timer)) {
+		fprintf(stderr, "watermark: no poll timer armed by the first sample\n");
+		ret = -1;
+	}
+	usleep(wm_check.timeout_ms * 1000 + 20000);
+	if (!(fops->poll(&filp, NULL) & EPOLLIN)) {
+		fprintf(stderr, "watermark: poll not ready past the timeout\n");
+		ret = -1;
+	}
+	fops->release(&inode, &filp);
+
+	return ret;
+}
+
+/*
+ * Returns the upper bound (in ns) of the log2 bucket
+ * below which `pct' percent of the samples of a stage fall.
+ */
+static double percentile(enum lunix_lat_enum stage, int pct)
+{
+	u64 total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < LUNIX_LAT_BUCKETS; i++)
+		total += lunix_latency.bucket[stage][i];
+	if (!total)
+		return 0;
+
+	for (i = 0; i < LUNIX_LAT_BUCKETS; i++) {
+		sum += lunix_latency.bucket[stage][i];
+		if (sum * 100 >= total * pct)
+			break;
+	}
+
+	return (double)(1ULL << min(i, 62));
+}
+
+/*
+ * Updates every sensor `rate' times per second for `seconds'
+ * seconds. Returns the number of sensor updates made.
+ */
+static unsigned long produce(int rate, int seconds)
+{
+	ktime_t period = 1000000000LL / rate;
+	ktime_t next = ktime_get(), end = next + seconds * 1000000000LL;
+	unsigned long updates = 0;
+	struct timespec ts;
+	uint16_t v;
+	int i;
+
+	for (v = 0; next < end; v++, next += period) {
+		ts.tv_sec = next / 1000000000;
+		ts.tv_nsec = next % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		/* One batch, as received by the line discipline */
+		for (i = 0; i < lunix_sensor_cnt; i++, updates++)
+			lunix_sensor_update(&lunix_sensors[i], v, v + 1, v + 2, lunix_latency_now());
+		lunix_sensor_wake_flush();
+	}
+
+	return updates;
+}
+
+static int run(int nreaders, int rate, int seconds)
+{
+	unsigned long reads = 0, bytes = 0, updates;
+	struct reader *readers;
+	pthread_attr_t attr;
+	int i, ret = 0;
+
+	readers = calloc(nreaders, sizeof(*readers));
+	if (!readers) {
+		perror("calloc");
+		return -1;
+	}
+
+	memset(&lunix_stats, 0, sizeof(lunix_stats));
+	memset(&lunix_latency, 0, sizeof(lunix_latency));
+
+	/* Spread the readers over all sensors and measurements */
+	pthread_barrier_init(&start_barrier, NULL, nreaders + 1);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 256 << 10);
+	for (i = 0; i < nreaders; i++) {
+		readers[i].minor = (i % lunix_sensor_cnt) * 8 + (i / lunix_sensor_cnt) % N_LUNIX_MSR;
+		if (pthread_create(&readers[i].thread, &attr, reader_fn, &readers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+
+	updates = produce(rate, seconds);
+
+	/* Let the last wakeups drain, then interrupt everybody */
+	usleep(100000);
+	for (i = 0; i < nreaders; i++)
+		lunix_shim_kill(readers[i].task);
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].reads;
+		bytes += readers[i].bytes;
+		if (readers[i].ret < 0) {
+			fprintf(stderr, "reader %d: error %d\n", i, readers[i].ret);
+			ret = -1;
+		}
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	printf("%7d %12.0f %10.1f %9.2f %9.1f %9.1f %9.1f %9.1f\n",
+	       nreaders, (double)reads / seconds, bytes / 1e3 / seconds,
+	       (double)lunix_stat_read(LUNIX_STAT_READER_WAKEUPS) / updates,
+	       percentile(LUNIX_LAT_SCHED, 50) / 1e3, percentile(LUNIX_LAT_SCHED, 99) / 1e3,
+	       percentile(LUNIX_LAT_E2E, 50) / 1e3, percentile(LUNIX_LAT_E2E, 99) / 1e3);
+	fflush(stdout);
+
+	free(readers);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [-r readers,...] [-s sensors] [-f rate] [-t seconds]\n\n"
+	        "  -r readers     comma-separated reader counts to run (default 1,10,100,1000)\n"
+	        "  -s sensors     number of sensors updated (default 16)\n"
+	        "  -f rate        updates per second, per sensor (default 100)\n"
+	        "  -t seconds     duration of each run (default 2)\n",
+	        argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char default_counts[] = "1,10,100,1000";
+	char *counts = default_counts, *tok;
+	int rate = 100, seconds = 2;
+	int opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "r:s:f:t:")) != -1) {
+		switch (opt) {
+		case 'r': counts = optarg; break;
+		case 's': lunix_sensor_cnt = atoi(optarg); break;
+		case 'f': rate = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (lunix_sensor_cnt < 1 || rate < 1 || seconds < 1)
+		usage(argv[0]);
+
+	/* Bring the driver up as lunix_module_init() would */
+	lunix_sensors = calloc(lunix_sensor_cnt, sizeof(*lunix_sensors));
+	if (!lunix_sensors) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		if (lunix_sensor_init(&lunix_sensors[i]) < 0)
+			goto out_init;
+	if (lunix_stats_init() < 0 || lunix_sensor_wake_init() < 0 || lunix_chrdev_init() < 0)
+		goto out_init;
+	static_branch_enable(&lunix_latency_key);
+
+	if (check_watermark() < 0)
+		ret = 1;
+
+	printf("%d sensors, %d updates/s each, %d s per run; latencies in usecs (log2 buckets)\n",
+	       lunix_sensor_cnt, rate, seconds);
+	printf("%7s %12s %10s %9s %9s %9s %9s %9s\n", "readers", "reads/s", "KB/s",
+	       "wake/upd", "sched50", "sched99", "e2e50", "e2e99");
+
+	for (tok = strtok(counts, ","); tok; tok = strtok(NULL, ","))
+		if (atoi(tok) > 0 && run(atoi(tok), rate, seconds) < 0)
+			ret = 1;
+
+	lunix_chrdev_destroy();
+	lunix_sensor_wake_destroy();
+	lunix_stats_destroy();
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		lunix_sensor_destroy(&lunix_sensors[i]);
+	free(lunix_sensors);
+
+	return ret;
+
+out_init:
+	fprintf(stderr, "driver initialization failed\n");
+	return 1;
+}
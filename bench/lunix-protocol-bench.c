@@ -0,0 +1,157 @@
+/*
+ * lunix-protocol-bench.c
+ *
+ * Throughput benchmark for the Lunix:TNG protocol parser,
+ * built in userspace against the shims in kshim.h.
+ *
+ * Feeds a synthetic XMesh stream to lunix_protocol_received_buf()
+ * and reports MB/s and packets/s.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kshim.h"
+#include "lunix.h"
+#include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-xmesh.h"
+
+/*
+ * Global state normally living in lunix-module.c
+ */
+int lunix_sensor_cnt = LUNIX_SENSOR_CNT;
+struct lunix_sensor_struct *lunix_sensors;
+
+static unsigned long updates;
+
+/*
+ * The parser's only output: count the updates instead of publishing them
+ */
+void lunix_sensor_update(struct lunix_sensor_struct *s,
+                         uint16_t batt, uint16_t temp, uint16_t light,
+                         ktime_t rx_time)
+{
+	updates++;
+}
+
+/*
+ * Returns a 16-bit measurement, whose bytes are forced to special
+ * characters with a probability of `escape_pct' percent each.
+ */
+static uint16_t random_value(int escape_pct)
+{
+	uint8_t b[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		b[i] = random();
+		if (random() % 100 < escape_pct)
+			b[i] = (random() & 1) ? XMESH_SYNC_BYTE : XMESH_ESCAPE_BYTE;
+	}
+
+	return b[0] | b[1] << 8;
+}
+
+/*
+ * Fills `buf' with up to `size' bytes worth of complete packets from
+ * `nodes' nodes, round-robin. Returns the length of the stream.
+ */
+static size_t make_stream(uint8_t *buf, size_t size, int nodes, int escape_pct,
+                          unsigned long *packets)
+{
+	uint8_t wire[XMESH_MAX_WIRE];
+	uint16_t seqno = 0;
+	size_t len = 0, n;
+
+	for (*packets = 0;; (*packets)++, seqno++) {
+		n = xmesh_sensor_packet(wire, 1 + seqno % nodes, seqno,
+		                        random_value(escape_pct), random_value(escape_pct),
+		                        random_value(escape_pct));
+		if (len + n > size)
+			break;
+		memcpy(buf + len, wire, n);
+		len += n;
+	}
+
+	return len;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [-n nodes] [-c chunk] [-e escape_pct] [-m megabytes] [-r rounds]\n\n"
+	        "  -n nodes       number of nodes sending packets (default 16)\n"
+	        "  -c chunk       bytes passed per call, 0 for the whole stream (default 64)\n"
+	        "  -e escape_pct  percentage of measurement bytes needing escaping (default 0)\n"
+	        "  -m megabytes   size of the synthetic stream (default 16)\n"
+	        "  -r rounds      number of passes over the stream (default 5)\n",
+	        argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lunix_protocol_state_struct state;
+	unsigned long packets, crc_errors;
+	int nodes = 16, escape_pct = 0, rounds = 5;
+	size_t chunk = 64, size = 16, len, off, n;
+	ktime_t start, elapsed, best = 0;
+	uint8_t *stream;
+	int opt, r;
+
+	while ((opt = getopt(argc, argv, "n:c:e:m:r:")) != -1) {
+		switch (opt) {
+		case 'n': nodes = atoi(optarg); break;
+		case 'c': chunk = atol(optarg); break;
+		case 'e': escape_pct = atoi(optarg); break;
+		case 'm': size = atol(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nodes < 1 || nodes > 65534 || rounds < 1 || size < 1)
+		usage(argv[0]);
+
+	lunix_sensor_cnt = max(nodes, LUNIX_SENSOR_CNT);
+	lunix_sensors = calloc(lunix_sensor_cnt, sizeof(*lunix_sensors));
+	size <<= 20;
+	stream = malloc(size);
+	if (!lunix_sensors || !stream) {
+		perror("malloc");
+		return 1;
+	}
+
+	srandom(1);
+	len = make_stream(stream, size, nodes, escape_pct, &packets);
+	if (!chunk)
+		chunk = len;
+
+	for (r = 0; r < rounds; r++) {
+		lunix_protocol_init(&state);
+		start = ktime_get();
+		for (off = 0; off < len; off += n) {
+			n = min(chunk, len - off);
+			lunix_protocol_received_buf(&state, stream + off, n);
+		}
+		elapsed = ktime_get() - start;
+		if (!best || elapsed < best)
+			best = elapsed;
+	}
+
+	crc_errors = lunix_stat_read(LUNIX_STAT_CRC_ERRORS);
+	printf("stream: %zu bytes, %lu packets, %d nodes, %d%% escaped, %zu-byte chunks\n",
+	       len, packets, nodes, escape_pct, chunk);
+	printf("best of %d: %.1f MB/s, %.0f packets/s, %.2f ns/byte\n", rounds,
+	       len / (best / 1e9) / 1e6, packets / (best / 1e9), (double)best / len);
+
+	if (updates != packets * rounds || crc_errors) {
+		fprintf(stderr, "parser lost packets: %lu updates, %lu crc errors, expected %lu\n",
+		        updates, crc_errors, packets * rounds);
+		return 1;
+	}
+
+	return 0;
+}
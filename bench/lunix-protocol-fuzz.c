@@ -0,0 +1,77 @@
+/*
+ * lunix-protocol-fuzz.c
+ *
+ * libFuzzer entry point for the Lunix:TNG protocol parser,
+ * built in userspace against the shims in kshim.h.
+ *
+ * The first input byte selects the chunk size the rest of the
+ * input is passed to lunix_protocol_received_buf() in, to exercise
+ * packets split across calls at every possible point.
+ *
+ * Built with -DLUNIX_FUZZ_STANDALONE, it runs the inputs given as
+ * arguments instead, e.g. to reproduce a crash without libFuzzer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kshim.h"
+#include "lunix.h"
+#include "lunix-protocol.h"
+
+int lunix_sensor_cnt = LUNIX_SENSOR_CNT;
+struct lunix_sensor_struct *lunix_sensors;
+
+void lunix_sensor_update(struct lunix_sensor_struct *s,
+                         uint16_t batt, uint16_t temp, uint16_t light,
+                         ktime_t rx_time)
+{
+	if (s < lunix_sensors || s >= lunix_sensors + lunix_sensor_cnt)
+		abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static struct lunix_protocol_state_struct state;
+	static struct lunix_sensor_struct sensors[LUNIX_SENSOR_CNT];
+	size_t chunk, off, n;
+
+	if (size < 1)
+		return 0;
+
+	lunix_sensors = sensors;
+	lunix_protocol_init(&state);
+
+	chunk = data[0] ? data[0] : size;
+	for (off = 1; off < size; off += n) {
+		n = min(chunk, size - off);
+		lunix_protocol_received_buf(&state, data + off, n);
+		if (state.pos < 0 || state.pos > MAX_PACKET_LEN)
+			abort();
+	}
+
+	return 0;
+}
+
+#ifdef LUNIX_FUZZ_STANDALONE
+int main(int argc, char *argv[])
+{
+	static uint8_t buf[1 << 20];
+	size_t len;
+	FILE *f;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!(f = fopen(argv[i], "rb"))) {
+			perror(argv[i]);
+			return 1;
+		}
+		len = fread(buf, 1, sizeof(buf), f);
+		fclose(f);
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+
+	return 0;
+}
+#endif
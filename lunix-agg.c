@@ -0,0 +1,261 @@
+/*
+ * lunix-agg.c
+ *
+ * Sliding-window aggregates (count, minimum, maximum, mean and
+ * standard deviation) of every measurement of every sensor, kept
+ * up to date as samples arrive, for Lunix:TNG
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+
+#include "lunix.h"
+#include "lunix-agg.h"
+
+/*
+ * The lengths of the windows, in seconds, fixed at load time.
+ * A zero length leaves its slot unused.
+ */
+static unsigned int lunix_agg_window_s[LUNIX_AGG_WINDOWS] = { 10, 60, 600 };
+static int lunix_agg_window_cnt = 3;
+module_param_array(lunix_agg_window_s, uint, &lunix_agg_window_cnt, 0444);
+MODULE_PARM_DESC(lunix_agg_window_s, "Lengths of the aggregation windows, in seconds, "
+                 "up to 4 of them (default: 10,60,600)");
+
+/*
+ * Returns the length of a bucket of window `w', in jiffies
+ */
+static u64 lunix_agg_bucket_len(int w)
+{
+	return max_t(u64, (u64)lunix_agg_window_s[w] * HZ / LUNIX_AGG_BUCKETS, 1);
+}
+
+/*
+ * Returns the bucket of window `w' the current time falls into,
+ * counted in bucket lengths since boot
+ */
+static u64 lunix_agg_epoch(int w)
+{
+	return div64_u64(get_jiffies_64(), lunix_agg_bucket_len(w));
+}
+
+static void lunix_agg_bucket_add(struct lunix_agg_bucket *b, long value)
+{
+	u64 sq = (u64)abs(value) * abs(value);
+
+	if (!b->count || value < b->min)
+		b->min = value;
+	if (!b->count || value > b->max)
+		b->max = value;
+	b->count++;
+	b->sum += value;
+	b->sumsq_hi += sq >> 32;
+	b->sumsq_lo += sq & 0xFFFFFFFF;
+}
+
+/*
+ * Slides a window forward to the given bucket, dropping the samples
+ * of the buckets it leaves behind from its totals. Sums are simply
+ * subtracted; the minimum and maximum are found again among the
+ * buckets left, at most once per bucket length.
+ */
+static void lunix_agg_rotate(struct lunix_agg_window_state *win, u64 epoch)
+{
+	struct lunix_agg_bucket *b, *total = &win->total;
+	bool dropped = false;
+	int i;
+
+	if (epoch <= win->epoch)
+		return;
+
+	if (epoch - win->epoch >= LUNIX_AGG_BUCKETS) {
+		memset(win->buckets, 0, sizeof(win->buckets));
+		memset(total, 0, sizeof(*total));
+		win->epoch = epoch;
+		return;
+	}
+
+	while (win->epoch != epoch) {
+		b = &win->buckets[++win->epoch & (LUNIX_AGG_BUCKETS - 1)];
+		if (!b->count)
+			continue;
+		total->count -= b->count;
+		total->sum -= b->sum;
+		total->sumsq_hi -= b->sumsq_hi;
+		total->sumsq_lo -= b->sumsq_lo;
+		memset(b, 0, sizeof(*b));
+		dropped = true;
+	}
+
+	if (!dropped || !total->count)
+		return;
+
+	b = win->buckets;
+	for (i = 0, total->min = LONG_MAX, total->max = LONG_MIN; i < LUNIX_AGG_BUCKETS; i++) {
+		if (!b[i].count)
+			continue;
+		total->min = min(total->min, b[i].min);
+		total->max = max(total->max, b[i].max);
+	}
+}
+
+/*
+ * Fills in the aggregates of a window from its totals
+ */
+static void lunix_agg_window_fill(struct lunix_agg_window *w, const struct lunix_agg_bucket *total)
+{
+	uint32_t n = total->count, r;
+	u64 q, mean_sq, sq_mean, var;
+
+	w->count = n;
+	if (!n) {
+		w->min = w->max = w->mean = w->stddev = 0;
+		return;
+	}
+
+	/*
+	 * variance = sumsq / n - (sum / n)^2, each term computed without
+	 * overflow to within a unit or two: sumsq from its two halves,
+	 * and the squared mean as (q + r / n)^2.
+	 */
+	sq_mean = mul_u64_u64_div_u64(total->sumsq_hi, 1ULL << 32, n) +
+	          div_u64(total->sumsq_lo, n);
+	q = div_u64_rem(abs(total->sum), n, &r);
+	mean_sq = q * q + div_u64(2 * q * r, n) + div_u64(div_u64((u64)r * r, n), n);
+	var = sq_mean > mean_sq ? sq_mean - mean_sq : 0;
+
+	w->min = total->min;
+	w->max = total->max;
+	w->mean = div64_s64(total->sum, total->count);
+	w->stddev = int_sqrt64(var);
+}
+
+/*
+ * Republishes the aggregates of a measurement in its page, from the
+ * totals of its windows. Called with the sensor's lock held.
+ */
+static void lunix_agg_publish(struct lunix_agg_struct *agg, enum lunix_msr_enum type)
+{
+	struct lunix_agg_data_struct *data = agg->agg_data[type];
+	int w;
+
+	WRITE_ONCE(data->seq, data->seq + 1);
+	smp_wmb();
+
+	data->last_update = agg->last_update;
+	data->nr_windows = lunix_agg_window_cnt;
+	for (w = 0; w < LUNIX_AGG_WINDOWS; w++) {
+		data->windows[w].window_s = w < lunix_agg_window_cnt ? lunix_agg_window_s[w] : 0;
+		lunix_agg_window_fill(&data->windows[w], &agg->win[type][w].total);
+	}
+
+	smp_wmb();
+	WRITE_ONCE(data->seq, data->seq + 1);
+}
+
+/*
+ * Adds the latest values of every measurement, in thousandths of
+ * their units, to the windows. O(1) per sample, with no division
+ * but that of the time into buckets; the pages are republished at
+ * most once per bucket length of the shortest window.
+ * Called with the sensor's lock held.
+ */
+void lunix_agg_update(struct lunix_sensor_struct *s, const long *values)
+{
+	struct lunix_agg_struct *agg = s->agg;
+	struct lunix_agg_window_state *win;
+	u64 epoch;
+	int i, w;
+
+	for (w = 0; w < lunix_agg_window_cnt; w++) {
+		if (!lunix_agg_window_s[w])
+			continue;
+		epoch = lunix_agg_epoch(w);
+		for (i = 0; i < N_LUNIX_MSR; i++) {
+			win = &agg->win[i][w];
+			lunix_agg_rotate(win, epoch);
+			lunix_agg_bucket_add(&win->buckets[epoch & (LUNIX_AGG_BUCKETS - 1)], values[i]);
+			lunix_agg_bucket_add(&win->total, values[i]);
+		}
+	}
+	agg->last_update = ktime_get_real_seconds();
+
+	if (time_before(jiffies, agg->next_publish))
+		return;
+	agg->next_publish = jiffies + agg->publish_len;
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		lunix_agg_publish(agg, i);
+}
+
+/*
+ * Brings the windows of a measurement up to date, dropping the
+ * samples they slid past since the last update, and copies out
+ * their aggregates. Called with the sensor's lock held.
+ */
+void lunix_agg_get(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+                   struct lunix_agg_data_struct *data)
+{
+	struct lunix_agg_struct *agg = s->agg;
+	int w;
+
+	for (w = 0; w < lunix_agg_window_cnt; w++)
+		if (lunix_agg_window_s[w])
+			lunix_agg_rotate(&agg->win[type][w], lunix_agg_epoch(w));
+
+	lunix_agg_publish(agg, type);
+	memcpy(data, agg->agg_data[type], sizeof(*data));
+}
+
+/*
+ * Initialization and destruction of the aggregates of a sensor
+ */
+int lunix_agg_init(struct lunix_sensor_struct *s)
+{
+	unsigned long p;
+	int i, w;
+
+	s->agg = kzalloc(sizeof(*s->agg), GFP_KERNEL);
+	if (!s->agg)
+		return -ENOMEM;
+
+	/* Republish as often as the shortest window slides, or every second */
+	s->agg->publish_len = 0;
+	for (w = 0; w < lunix_agg_window_cnt; w++)
+		if (lunix_agg_window_s[w] && (!s->agg->publish_len ||
+		                              lunix_agg_bucket_len(w) < s->agg->publish_len))
+			s->agg->publish_len = lunix_agg_bucket_len(w);
+	if (!s->agg->publish_len)
+		s->agg->publish_len = HZ;
+	s->agg->next_publish = jiffies;
+
+	for (i = 0; i < N_LUNIX_MSR; i++) {
+		p = get_zeroed_page(GFP_KERNEL);
+		if (!p)
+			return -ENOMEM;
+		s->agg->agg_data[i] = (struct lunix_agg_data_struct *)p;
+		s->agg->agg_data[i]->magic = LUNIX_AGG_MAGIC;
+		lunix_agg_publish(s->agg, i);
+	}
+
+	return 0;
+}
+
+void lunix_agg_destroy(struct lunix_sensor_struct *s)
+{
+	int i;
+
+	if (!s->agg)
+		return;
+
+	for (i = 0; i < N_LUNIX_MSR; i++) {
+		if (s->agg->agg_data[i])
+			free_page((unsigned long)s->agg->agg_data[i]);
+	}
+	kfree(s->agg);
+	s->agg = NULL;
+}
@@ -0,0 +1,76 @@
+/*
+ * lunix-agg.h
+ *
+ * Definition file for the sliding-window
+ * aggregates of Lunix:TNG measurements
+ */
+
+#ifndef _LUNIX_AGG_H
+#define _LUNIX_AGG_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+
+#include "lunix.h"
+
+/*
+ * Number of buckets a window is divided into (a power of two).
+ * A window slides a bucket at a time: it covers the current bucket
+ * and the LUNIX_AGG_BUCKETS - 1 before it, i.e. between 15/16ths
+ * of its length and its whole length.
+ */
+#define LUNIX_AGG_BUCKETS 16
+
+/*
+ * The samples that fell into a bucket, or into a whole window,
+ * in thousandths of the measurement unit. The high and low 32 bits
+ * of their squares are summed apart, so that neither sum can
+ * overflow before the count does.
+ */
+struct lunix_agg_bucket {
+	uint32_t count;
+	long min;
+	long max;
+	s64 sum;
+	u64 sumsq_hi;
+	u64 sumsq_lo;
+};
+
+/*
+ * A window of one measurement: its buckets, the running totals over
+ * all of them, and the bucket the latest sample fell into, counted
+ * in bucket lengths since boot.
+ */
+struct lunix_agg_window_state {
+	u64 epoch;
+	struct lunix_agg_bucket total;
+	struct lunix_agg_bucket buckets[LUNIX_AGG_BUCKETS];
+};
+
+/*
+ * The windows of every measurement of a sensor, and the pages their
+ * aggregates are published in, for mmap(). Samples only go into the
+ * buckets; the pages are republished at most once per `publish_len'
+ * jiffies, the bucket length of the shortest window, and on reads.
+ */
+struct lunix_agg_struct {
+	struct lunix_agg_window_state win[N_LUNIX_MSR][LUNIX_AGG_WINDOWS];
+	struct lunix_agg_data_struct *agg_data[N_LUNIX_MSR];
+	uint32_t last_update;
+	unsigned long publish_len;
+	unsigned long next_publish;
+};
+
+/*
+ * Function prototypes
+ */
+int lunix_agg_init(struct lunix_sensor_struct *s);
+void lunix_agg_destroy(struct lunix_sensor_struct *s);
+void lunix_agg_update(struct lunix_sensor_struct *s, const long *values);
+void lunix_agg_get(struct lunix_sensor_struct *s, enum lunix_msr_enum type,
+                   struct lunix_agg_data_struct *data);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LUNIX_AGG_H */
@@ -7,9 +7,16 @@
  * Based on slattach.c for SLIP operation
  * [net-tools Debian package].
  *
+ * It can also act as the connector to the base station itself:
+ * it then creates a pty, attaches the line discipline to it and
+ * pumps the data from a TCP endpoint into it, reconnecting as
+ * needed, instead of a separate socat process.
+ *
  * Must be run with root privilege.
  */
 
+#define _GNU_SOURCE
+
 #include <pwd.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -20,15 +27,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <termios.h>
+#include <asm/termbits.h>
+#include <netdb.h>
+#include <time.h>
 
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/serial.h>
 
 #include "lunix.h"
+#include "lunix-ldisc.h"
 
 #ifndef _PATH_LOCKD
 #define _PATH_LOCKD "/var/lock" /* lock files */
@@ -65,6 +80,21 @@ struct {
 #endif
 #ifdef B115200
 	{ "115200", B115200},
+#endif
+#ifdef B230400
+	{ "230400", B230400},
+#endif
+#ifdef B460800
+	{ "460800", B460800},
+#endif
+#ifdef B500000
+	{ "500000", B500000},
+#endif
+#ifdef B576000
+	{ "576000", B576000},
+#endif
+#ifdef B921600
+	{ "921600", B921600},
 #endif
 	{ NULL, 0}
 };
@@ -72,10 +102,32 @@ struct {
 /*
  * Global data
  *
+ * Every TTY attached keeps what it takes to put it back
+ * the way it was found.
+ */
+#define MAX_TTYS 16
+
+struct lunix_tty {
+	char *name;
+	int fd;
+	struct termios2 before, current;
+	int ldisc_before;
+	int serial_before;      /* Serial driver flags, -1 if not a serial port */
+	char lock_path[PATH_MAX];
+	int locked;
+	char trig_path[PATH_MAX], trig_before[16];      /* UART FIFO trigger level */
+} ttys[MAX_TTYS];
+int tty_cnt;
+
+/*
+ * Line settings, from the command line. The sensors need
+ * 57600bps, 8 data bits, No parity, 1 stop bit by default.
  */
-int tty_fd = -1;
-struct termios tty_before, tty_current;
-int ldisc_before;
+const char *tty_speed = "57600";
+const char *tty_framing = "8N1";
+int tty_low_latency = 1;
+int tty_rx_trig = 1;            /* Bytes in the UART FIFO before it interrupts, 0 to leave alone */
+int tty_standby;                /* The TTYs after the first are hot standbys */
 
 /* Check for an existing lock file on our device */
 static int tty_already_locked(char *nam)
@@ -107,26 +159,24 @@ static int tty_already_locked(char *nam)
 }
 
 /* Lock or unlock a terminal line. */
-static int tty_lock(char *path, int mode)
+static int tty_lock(struct lunix_tty *t, char *path, int mode)
 {
 	int fd;
 	int ret;
 	char apid[16];
 	struct passwd *pw;
-	static int saved_lock = 0;
-	static char saved_path[PATH_MAX];
 
 	/* We do not lock standard input. */
 	if (mode == 1) { /* lock */
-		sprintf(saved_path, "%s/LCK..%s", _PATH_LOCKD, path);
-		if (tty_already_locked(saved_path)) {
+		snprintf(t->lock_path, sizeof(t->lock_path), "%s/LCK..%s", _PATH_LOCKD, path);
+		if (tty_already_locked(t->lock_path)) {
 			fprintf(stderr, "/dev/%s already locked\n", path);
 			return -1;
 		}
-		if ((fd = creat(saved_path, 0644)) < 0) {
+		if ((fd = creat(t->lock_path, 0644)) < 0) {
 			if (errno != EEXIST) {
 				fprintf(stderr, "tty_lock: (%s): %s\n",
-						saved_path, strerror(errno));
+						t->lock_path, strerror(errno));
 			}
 			return -1;
 		}
@@ -134,27 +184,27 @@ static int tty_lock(char *path, int mode)
 		if ((ret = write(fd, apid, strlen(apid))) != strlen(apid)) {
 			fprintf(stderr, "write to PID file incomplete, ret = %d\n", ret);
 			close(fd);
-			unlink(saved_path);
+			unlink(t->lock_path);
 			return -1;
 		}
 		(void) close(fd);
+		t->locked = 1;
 
 		/* Make sure UUCP owns the lockfile.  Required by some packages. */
 		if ((pw = getpwnam(_UID_UUCP)) == NULL) {
 			fprintf(stderr, "tty_lock: UUCP user %s unknown\n", _UID_UUCP);
 			return 0;
 		}
-		(void) chown(saved_path, pw->pw_uid, pw->pw_gid);
-		saved_lock = 1;
+		(void) chown(t->lock_path, pw->pw_uid, pw->pw_gid);
 	} else { /* unlock */
-		if (saved_lock != 1)
+		if (t->locked != 1)
 			return 0;
-		if (unlink(saved_path) < 0) {
+		if (unlink(t->lock_path) < 0) {
 			fprintf(stderr, "tty_unlock: (%s): %s\n",
-				saved_path, strerror(errno));
+				t->lock_path, strerror(errno));
 			return -1;
 		}
-		saved_lock = 0;
+		t->locked = 0;
 	}
 
 	return 0;
@@ -176,7 +226,7 @@ static int tty_find_speed(const char *speed)
 }
 
 /* Set the number of stop bits. */
-static int tty_set_stopbits(struct termios *tty, char *stopbits)
+static int tty_set_stopbits(struct termios2 *tty, char *stopbits)
 {
 	switch(*stopbits) {
 	case '1':
@@ -195,7 +245,7 @@ static int tty_set_stopbits(struct termios *tty, char *stopbits)
 }
 
 /* Set the number of data bits. */
-static int tty_set_databits(struct termios *tty, char *databits)
+static int tty_set_databits(struct termios2 *tty, char *databits)
 {
 	tty->c_cflag &= ~CSIZE;
 	switch(*databits) {
@@ -223,7 +273,7 @@ static int tty_set_databits(struct termios *tty, char *databits)
 }
 
 /* Set the type of parity encoding. */
-static int tty_set_parity(struct termios *tty, char *parity)
+static int tty_set_parity(struct termios2 *tty, char *parity)
 {
 	switch(toupper(*parity)) {
 	case 'N':
@@ -247,22 +297,54 @@ static int tty_set_parity(struct termios *tty, char *parity)
 	return 0;
 }
 
+/* Set data bits, parity and stop bits, given as e.g. "8N1" or "7E2". */
+static int tty_set_framing(struct termios2 *tty, const char *framing)
+{
+	char buf[4];
+
+	if (strlen(framing) != 3)
+		return -EINVAL;
+	memcpy(buf, framing, sizeof(buf));
 
-/* Set the line speed of a terminal line. */
-static int tty_set_speed(struct termios *tty, const char *speed)
+	if (tty_set_databits(tty, &buf[0]) ||
+	    tty_set_parity(tty, &buf[1]) ||
+	    tty_set_stopbits(tty, &buf[2]))
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Set the line speed of a terminal line. Rates not in the table
+ * are set as they are, for the driver to approximate them as
+ * closely as its UART clock allows.
+ */
+static int tty_set_speed(struct termios2 *tty, const char *speed)
 {
+	unsigned long rate;
+	char *end;
 	int code;
-	if ((code = tty_find_speed(speed)) < 0)
-		return code;
-	tty->c_cflag &= ~CBAUD;
-	tty->c_cflag |= code;
+
+	/* The input speed follows the output speed */
+	tty->c_cflag &= ~(CBAUD | CIBAUD);
+
+	if ((code = tty_find_speed(speed)) >= 0) {
+		tty->c_cflag |= code;
+		return 0;
+	}
+
+	rate = strtoul(speed, &end, 10);
+	if (*end || rate == 0 || rate > UINT_MAX)
+		return -EINVAL;
+	tty->c_cflag |= BOTHER;
+	tty->c_ispeed = tty->c_ospeed = rate;
 
 	return 0;
 }
 
 
 /* Put a terminal line in a transparent state. */
-static int tty_set_raw(struct termios *tty)
+static int tty_set_raw(struct termios2 *tty)
 {
 	int i;
 	int speed;
@@ -284,11 +366,11 @@ static int tty_set_raw(struct termios *tty)
 
 
 /* Fetch the state of a terminal. */
-static int tty_get_state(struct termios *tty)
+static int tty_get_state(struct lunix_tty *t, struct termios2 *tty)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TCGETS, tty) < 0) {
+	if (ioctl(t->fd, TCGETS2, tty) < 0) {
 		saved_errno = errno;
 		perror("Get TTY State:");
 		return -saved_errno;
@@ -298,11 +380,11 @@ static int tty_get_state(struct termios *tty)
 }
 
 /* Set the state of a terminal. */
-static int tty_set_state(struct termios *tty)
+static int tty_set_state(struct lunix_tty *t, struct termios2 *tty)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TCSETS, tty) < 0) {
+	if (ioctl(t->fd, TCSETS2, tty) < 0) {
 		saved_errno = errno;
 		perror("Set TTY State:");
 		return -saved_errno;
@@ -312,11 +394,11 @@ static int tty_set_state(struct termios *tty)
 }
 
 /* Get the TTY line discipline. */
-static int tty_get_ldisc(int *disc)
+static int tty_get_ldisc(struct lunix_tty *t, int *disc)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TIOCGETD, disc) < 0) {
+	if (ioctl(t->fd, TIOCGETD, disc) < 0) {
 		saved_errno = errno;
 		perror("get ldisc: failed to get line discipline");
 		fprintf(stderr, "Is the Lunix:TNG discipline actually loaded?!\n");
@@ -327,11 +409,11 @@ static int tty_get_ldisc(int *disc)
 }
 
 /* Set the TTY line discipline. */
-static int tty_set_ldisc(int disc)
+static int tty_set_ldisc(struct lunix_tty *t, int disc)
 {
 	int saved_errno;
 
-	if (ioctl(tty_fd, TIOCSETD, &disc) < 0) {
+	if (ioctl(t->fd, TIOCSETD, &disc) < 0) {
 		saved_errno = errno;
 		perror("set ldisc: failed to set line discipline");
 		return -saved_errno;
@@ -340,15 +422,90 @@ static int tty_set_ldisc(int disc)
 	return 0;
 }
 
+/* Make the line discipline hold the data of the TTY while a primary one delivers. */
+static int tty_set_standby(struct lunix_tty *t)
+{
+	int saved_errno, role = LUNIX_LDISC_STANDBY;
+
+	if (ioctl(t->fd, LUNIX_LDISC_IOC_SET_ROLE, &role) < 0) {
+		saved_errno = errno;
+		perror("set standby: failed to make the line a standby");
+		return -saved_errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Ask the serial driver to hand received data over as soon as
+ * they arrive, instead of batching them. Drivers that do not
+ * know about it (e.g. ptys) are left alone.
+ */
+static void tty_set_low_latency(struct lunix_tty *t)
+{
+	struct serial_struct ss;
+
+	t->serial_before = -1;
+	if (ioctl(t->fd, TIOCGSERIAL, &ss) < 0)
+		return;
+
+	t->serial_before = ss.flags;
+	ss.flags |= ASYNC_LOW_LATENCY;
+	if (ioctl(t->fd, TIOCSSERIAL, &ss) < 0)
+		fprintf(stderr, "tty_open: %s: cannot set low latency mode: %s\n",
+			t->name, strerror(errno));
+}
+
+/*
+ * Set the receive FIFO trigger level of a 16550-style UART,
+ * so that the UART interrupts after a few bytes instead of
+ * when its FIFO is almost full. Most other devices have no
+ * such attribute, and are left alone.
+ */
+static void tty_set_rx_trig(struct lunix_tty *t, const char *path_open)
+{
+	char val[16];
+	ssize_t n;
+	int fd;
+
+	snprintf(t->trig_path, sizeof(t->trig_path), "/sys/class/tty/%s/rx_trig_bytes",
+		 strrchr(path_open, '/') ? strrchr(path_open, '/') + 1 : path_open);
+	if ((fd = open(t->trig_path, O_RDWR)) < 0) {
+		t->trig_path[0] = '\0';
+		return;
+	}
+
+	if ((n = read(fd, t->trig_before, sizeof(t->trig_before) - 1)) <= 0) {
+		t->trig_path[0] = '\0';
+		close(fd);
+		return;
+	}
+	t->trig_before[n] = '\0';
+
+	/* The UART rounds the level up to one it supports */
+	snprintf(val, sizeof(val), "%d", tty_rx_trig);
+	if (pwrite(fd, val, strlen(val), 0) < 0)
+		fprintf(stderr, "tty_open: %s: cannot set FIFO trigger level: %s\n",
+			t->name, strerror(errno));
+	close(fd);
+}
+
 /* Restore the TTY to its previous state. */
-static int tty_restore(void)
+static int tty_restore(struct lunix_tty *t)
 {
-	int ret;
-	struct termios tty;
+	int ret, fd;
+	struct serial_struct ss;
+
+	if (t->trig_path[0] && (fd = open(t->trig_path, O_WRONLY)) >= 0) {
+		(void) write(fd, t->trig_before, strlen(t->trig_before));
+		close(fd);
+	}
+	if (t->serial_before >= 0 && ioctl(t->fd, TIOCGSERIAL, &ss) == 0) {
+		ss.flags = t->serial_before;
+		(void) ioctl(t->fd, TIOCSSERIAL, &ss);
+	}
 
-	tty = tty_before;
-	(void) tty_set_speed(&tty, "0");
-	if ((ret = tty_set_state(&tty)) < 0) {
+	if ((ret = tty_set_state(t, &t->before)) < 0) {
 		fprintf(stderr, "slattach: tty_restore: %s\n",
 			strerror(-ret));
 		return ret;
@@ -358,142 +515,508 @@ static int tty_restore(void)
 }
 
 /* Close down a terminal line. */
-static int tty_close(void)
+static int tty_close(struct lunix_tty *t)
 {
 	/*
 	 * Set the old discipline and restore the
 	 * previous line mode.
 	 */
-	(void) tty_set_ldisc(ldisc_before);
-	(void) tty_restore();
-	(void) tty_lock(NULL, 0);
+	(void) tty_set_ldisc(t, t->ldisc_before);
+	(void) tty_restore(t);
+	(void) tty_lock(t, NULL, 0);
 
 	return 0;
 }
 
-/* Open and initialize a terminal line. */
-static int tty_open(char *name)
+/* Close down all terminal lines opened so far. */
+static void tty_close_all(void)
 {
+	int i;
+
+	for (i = 0; i < tty_cnt; i++)
+		tty_close(&ttys[i]);
+	tty_cnt = 0;
+}
+
+/*
+ * Open and initialize a terminal line, locking it unless told otherwise.
+ * On success, it is added to ttys[], for tty_close_all().
+ */
+static int tty_open(char *name, int lock)
+{
+	struct lunix_tty *t;
 	int fd;
 	int ret;
 	int saved_errno;
 	char pathbuf[PATH_MAX];
 	register char *path_open, *path_lock;
 
+	if (tty_cnt == MAX_TTYS) {
+		fprintf(stderr, "tty_open: at most %d TTYs\n", MAX_TTYS);
+		return -1;
+	}
+	t = &ttys[tty_cnt];
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->serial_before = -1;
+
 	/* Try opening the TTY device. */
-	if (name != NULL) {
-		if (name[0] != '/') {
-			if (strlen(name + 6) > sizeof(pathbuf)) {
-				fprintf(stderr, "tty name too long\n");
-				return -1;
-			}
-			sprintf(pathbuf, "/dev/%s", name);
-			path_open = pathbuf;
-			path_lock = name;
-		} else if (!strncmp(name, "/dev/", 5)) {
-			path_open = name;
-			path_lock = name + 5;
-		} else {
-			path_open = name;
-			path_lock = name;
+	if (name[0] != '/') {
+		if (strlen(name + 6) > sizeof(pathbuf)) {
+			fprintf(stderr, "tty name too long\n");
+			return -1;
 		}
+		sprintf(pathbuf, "/dev/%s", name);
+		path_open = pathbuf;
+		path_lock = name;
+	} else if (!strncmp(name, "/dev/", 5)) {
+		path_open = name;
+		path_lock = name + 5;
+	} else {
+		path_open = name;
+		path_lock = name;
+	}
 
+	if (lock) {
 		fprintf(stderr, "tty_open: looking for lock\n");
-		if (tty_lock(path_lock, 1))
+		if (tty_lock(t, path_lock, 1))
 			return -1 ; /* can we lock the device? */
-		fprintf(stderr, "tty_open: trying to open %s\n",
-			path_open);
-		if ((fd = open(path_open, O_RDWR|O_NDELAY)) < 0) {
-			saved_errno = errno;
-			fprintf(stderr, "tty_open(%s, RW): %s\n",
-				path_open, strerror(errno));
-			return -saved_errno;
-		}
-		tty_fd = fd;
-		fprintf(stderr, "tty_open: %s (fd=%d) ", path_open, fd);
-	} else {
-		tty_fd = 0;
 	}
+	fprintf(stderr, "tty_open: trying to open %s\n",
+		path_open);
+	if ((fd = open(path_open, O_RDWR|O_NDELAY)) < 0) {
+		saved_errno = errno;
+		fprintf(stderr, "tty_open(%s, RW): %s\n",
+			path_open, strerror(errno));
+		ret = -saved_errno;
+		goto out_unlock;
+	}
+	t->fd = fd;
+	fprintf(stderr, "tty_open: %s (fd=%d)\n", path_open, fd);
 
 	/* Fetch the current state of the terminal. */
-	if (tty_get_state(&tty_before) < 0) {
-		saved_errno = errno;
+	if ((ret = tty_get_state(t, &t->before)) < 0) {
 		fprintf(stderr, "tty_open: cannot get current state\n");
-		return -saved_errno;
+		goto out_close;
 	}
-	tty_current = tty_before;
+	t->current = t->before;
 
 	/* Fetch the current line discipline of this terminal. */
-	if (tty_get_ldisc(&ldisc_before) < 0) {
-		saved_errno = errno;
+	if ((ret = tty_get_ldisc(t, &t->ldisc_before)) < 0) {
 		fprintf(stderr, "tty_open: cannot get current line disc\n");
-		return -saved_errno;
+		goto out_close;
 	}
 
 	/* Put this terminal line in a 8-bit transparent mode. */
-	if (tty_set_raw(&tty_current) < 0) {
-		saved_errno = errno;
+	if ((ret = tty_set_raw(&t->current)) < 0) {
 		fprintf(stderr, "tty_open: cannot set RAW mode\n");
-		return -saved_errno;
+		goto out_close;
 	}
 
-	/**************************************************
-	 * The sensor needs to be setup at
-	 * 57600bps, 8 data bits, No parity, 1 stop bit:
-	 **************************************************
-	 */
-	if (tty_set_speed(&tty_current, "57600") != 0) {
-		saved_errno = errno;
-		fprintf(stderr, "tty_open: cannot set data rate to 57600bps\n");
-		return -saved_errno;
+	/* Line speed and framing, as given on the command line */
+	if ((ret = tty_set_speed(&t->current, tty_speed)) < 0) {
+		fprintf(stderr, "tty_open: cannot set data rate to %sbps\n", tty_speed);
+		goto out_close;
 	}
-	if (tty_set_databits(&tty_current, "8") ||
-	    tty_set_stopbits(&tty_current, "1") ||
-	    tty_set_parity(&tty_current, "N")) {
-		saved_errno = errno;
-		fprintf(stderr, "tty_open: cannot set 8N1 mode\n");
-		return -saved_errno;
+	if ((ret = tty_set_framing(&t->current, tty_framing)) < 0) {
+		fprintf(stderr, "tty_open: cannot set %s mode\n", tty_framing);
+		goto out_close;
 	};
 
 	/* Set the new line mode. */
-	if ((ret = tty_set_state(&tty_current)) < 0)
-		return ret;
+	if ((ret = tty_set_state(t, &t->current)) < 0)
+		goto out_close;
+
+	/* Do not let the serial driver sit on received data */
+	if (tty_low_latency)
+		tty_set_low_latency(t);
+	if (tty_rx_trig)
+		tty_set_rx_trig(t, path_open);
 
 	/* And activate the new line discipline */
-	if ((ret = tty_set_ldisc(N_LUNIX_LDISC)) < 0)
-		return ret;
+	if ((ret = tty_set_ldisc(t, N_LUNIX_LDISC)) < 0) {
+		tty_restore(t);
+		goto out_close;
+	}
+	if (tty_standby && tty_cnt > 0 && (ret = tty_set_standby(t)) < 0) {
+		(void) tty_set_ldisc(t, t->ldisc_before);
+		tty_restore(t);
+		goto out_close;
+	}
 
+	tty_cnt++;
 	return 0;
+
+out_close:
+	close(fd);
+out_unlock:
+	tty_lock(t, NULL, 0);
+	return ret;
+}
+
+/*
+ * Connector mode: the data of the base station come from a TCP
+ * endpoint and are pumped into the master side of a pty, whose
+ * slave side has the line discipline attached.
+ */
+#define PUMP_PIPE_SIZE   (1 << 20)      /* Bytes in flight from the socket to the pty */
+#define PUMP_RCVBUF      (1 << 20)
+#define BACKOFF_MIN_MS   100
+#define BACKOFF_MAX_MS   30000
+
+int pty_master = -1;
+int pump_pipe[2] = { -1, -1 };
+int pump_splice_pty = 1;        /* Cleared if the pty does not take splice() */
+
+/*
+ * Throughput and gap statistics, over the current reporting
+ * interval and since the start
+ */
+struct {
+	unsigned long long bytes, total_bytes;
+	unsigned long reads, gaps, total_gaps, connects;
+	long long last_rx, max_gap, last_report;
+} pump_stats;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Create a pty, and return the path of its slave side. */
+static char *pty_create(void)
+{
+	char *name;
+
+	if ((pty_master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	    grantpt(pty_master) < 0 || unlockpt(pty_master) < 0 ||
+	    (name = ptsname(pty_master)) == NULL) {
+		perror("pty_create");
+		return NULL;
+	}
+
+	return strdup(name);
+}
+
+/* Connect to host:port, returning a non-blocking socket. */
+static int tcp_connect(const char *endpoint)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *ai, *p;
+	struct timeval tv = { .tv_sec = 5 };
+	char host[256], *port;
+	int fd = -1, one = 1, size = PUMP_RCVBUF, ret;
+
+	snprintf(host, sizeof(host), "%s", endpoint);
+	if ((port = strrchr(host, ':')) == NULL) {
+		fprintf(stderr, "tcp_connect: %s: expected host:port\n", endpoint);
+		return -1;
+	}
+	*port++ = '\0';
+
+	if ((ret = getaddrinfo(host, port, &hints, &ai)) != 0) {
+		fprintf(stderr, "tcp_connect: %s: %s\n", endpoint, gai_strerror(ret));
+		return -1;
+	}
+	for (p = ai; p; p = p->ai_next) {
+		if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+			continue;
+
+		/* A bounded connect, a large receive buffer, and keepalives for dead links */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+
+	if (fd < 0) {
+		fprintf(stderr, "tcp_connect: %s: %s\n", endpoint, strerror(errno));
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return fd;
+}
+
+/* Move len bytes from the pump pipe into the pty. */
+static int pump_to_pty(size_t len)
+{
+	char buf[65536];
+	ssize_t n, w, m;
+
+	while (len > 0) {
+		if (pump_splice_pty) {
+			n = splice(pump_pipe[0], NULL, pty_master, NULL, len, SPLICE_F_MOVE);
+			if (n < 0 && errno == EINVAL) {
+				fprintf(stderr, "pump: pty does not support splice(), copying\n");
+				pump_splice_pty = 0;
+				continue;
+			}
+		} else {
+			n = read(pump_pipe[0], buf, MIN(len, sizeof(buf)));
+			for (w = 0; n > 0 && w < n; w += m) {
+				if ((m = write(pty_master, buf + w, n - w)) < 0) {
+					if (errno == EINTR) {
+						m = 0;
+						continue;
+					}
+					perror("pump: pty");
+					return -1;
+				}
+			}
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pump: pty");
+			return -1;
+		}
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Drain the socket into the pty, through the pump pipe, until it
+ * would block. Returns 0, or -1 when the connection is gone.
+ */
+static int pump_socket(int sock, int gap_ms)
+{
+	long long now;
+	ssize_t n;
+
+	for (;;) {
+		n = splice(sock, NULL, pump_pipe[1], NULL, PUMP_PIPE_SIZE,
+		           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0) {
+			if (errno == EAGAIN)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			perror("pump: socket");
+			return -1;
+		}
+		if (n == 0) {
+			fprintf(stderr, "pump: connection closed by the other end\n");
+			return -1;
+		}
+
+		/* Account for the silence that this data ended */
+		now = now_ms();
+		if (pump_stats.last_rx) {
+			if (now - pump_stats.last_rx > pump_stats.max_gap)
+				pump_stats.max_gap = now - pump_stats.last_rx;
+			if (now - pump_stats.last_rx >= gap_ms)
+				pump_stats.gaps++;
+		}
+		pump_stats.last_rx = now;
+		pump_stats.reads++;
+		pump_stats.bytes += n;
+
+		if (pump_to_pty(n) < 0)
+			return -1;
+	}
+}
+
+static void pump_report(int gap_ms)
+{
+	long long now = now_ms();
+	double secs = (now - pump_stats.last_report) / 1000.0;
+
+	pump_stats.total_bytes += pump_stats.bytes;
+	pump_stats.total_gaps += pump_stats.gaps;
+	fprintf(stderr, "pump: %.1f KB/s, %lu reads of %.0f bytes, max gap %lld ms, "
+	        "%lu gaps >= %d ms; total %llu KB, %lu gaps, %lu connects\n",
+	        pump_stats.bytes / 1024.0 / secs, pump_stats.reads,
+	        pump_stats.reads ? (double)pump_stats.bytes / pump_stats.reads : 0.0,
+	        pump_stats.max_gap, pump_stats.gaps, gap_ms, pump_stats.total_bytes / 1024,
+	        pump_stats.total_gaps, pump_stats.connects);
+
+	pump_stats.bytes = pump_stats.reads = pump_stats.gaps = 0;
+	pump_stats.max_gap = 0;
+	pump_stats.last_report = now;
+}
+
+/*
+ * Pump data from the endpoint into the pty until killed, reconnecting
+ * with backoff when the connection fails, drops, or stays silent for
+ * longer than stall_s seconds.
+ */
+static int pump_run(const char *endpoint, int report_s, int gap_ms, int stall_s)
+{
+	struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+	struct epoll_event ev, events[2];
+	int epfd, tfd, sock = -1, backoff = BACKOFF_MIN_MS, i, n;
+	uint64_t expirations;
+	struct timespec ts;
+
+	if (pipe2(pump_pipe, O_CLOEXEC) < 0) {
+		perror("pump: pipe");
+		return -1;
+	}
+	fcntl(pump_pipe[1], F_SETPIPE_SZ, PUMP_PIPE_SIZE);
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+		perror("pump: epoll");
+		return -1;
+	}
+	timerfd_settime(tfd, 0, &tick, NULL);
+	ev.events = EPOLLIN;
+	ev.data.fd = tfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	pump_stats.last_report = now_ms();
+
+	for (;;) {
+		if (sock < 0) {
+			fprintf(stderr, "pump: connecting to %s\n", endpoint);
+			if ((sock = tcp_connect(endpoint)) < 0) {
+				fprintf(stderr, "pump: retrying in %d ms\n", backoff);
+				ts.tv_sec = backoff / 1000;
+				ts.tv_nsec = backoff % 1000 * 1000000L;
+				nanosleep(&ts, NULL);
+				backoff = MIN(backoff * 2, BACKOFF_MAX_MS);
+				continue;
+			}
+			fprintf(stderr, "pump: connected, pumping into %s\n", ptsname(pty_master));
+			backoff = BACKOFF_MIN_MS;
+			pump_stats.connects++;
+			pump_stats.last_rx = now_ms();
+
+			ev.events = EPOLLIN | EPOLLRDHUP;
+			ev.data.fd = sock;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+		}
+
+		if ((n = epoll_wait(epfd, events, 2, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pump: epoll_wait");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == tfd) {
+				(void) read(tfd, &expirations, sizeof(expirations));
+				if (report_s && now_ms() - pump_stats.last_report >= report_s * 1000LL)
+					pump_report(gap_ms);
+				if (sock >= 0 && now_ms() - pump_stats.last_rx >= stall_s * 1000LL) {
+					fprintf(stderr, "pump: no data for %d s, reconnecting\n", stall_s);
+					close(sock);
+					sock = -1;
+				}
+			} else if (sock >= 0 && pump_socket(sock, gap_ms) < 0) {
+				close(sock);
+				sock = -1;
+			}
+		}
+	}
 }
 
 /* Catch any signals. */
 static void sig_catch(int sig)
 {
-	tty_close();
+	tty_close_all();
 	exit(0);
 }
 
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [-b speed] [-f framing] [-T rx_trig] [-N] [-S] tty_line...\n"
+	        "       %s -c host:port [-i report_s] [-g gap_ms] [-s stall_s]\n\n"
+	        "In the first form, set the Lunix line discipline on each tty_line:\n\n"
+	        "  -b speed       line speed, in bps; rates the TTY layer has no\n"
+	        "                 constant for are passed on as they are (default 57600)\n"
+	        "  -f framing     data bits, parity and stop bits (default 8N1)\n"
+	        "  -T rx_trig     UART receive FIFO trigger level, in bytes, where\n"
+	        "                 supported; 0 to leave it alone (default 1)\n"
+	        "  -N             leave the serial driver's low latency mode alone\n"
+	        "  -S             make the first tty_line the primary feed, and the\n"
+	        "                 others hot standbys, published from only while the\n"
+	        "                 primary is silent\n\n"
+	        "In the second, create a pty with the line discipline set, and pump\n"
+	        "the data received from host:port into it, reconnecting as needed:\n\n"
+	        "  -c host:port   TCP endpoint of the base station, or of lunix-sim\n"
+	        "  -i report_s    report throughput and gaps every report_s seconds,\n"
+	        "                 0 to never (default 10)\n"
+	        "  -g gap_ms      count silences of at least gap_ms as gaps (default 1000)\n"
+	        "  -s stall_s     reconnect after stall_s seconds of silence (default 30)\n\n",
+	        argv0, argv0);
+	exit(1);
+}
+
 int main(int argc, char *argv[])
 {
-	if (argc != 2) {
-		fprintf(stderr,
-		        "Usage: %s tty_line\n"
-		        "where tty_line is the TTY on which to set the Lunix line discipline.\n\n",
-		        argv[0]);
-		exit(1);
+	char *endpoint = NULL, *tty_name;
+	int report_s = 10, gap_ms = 1000, stall_s = 30;
+	struct termios2 check;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "b:f:T:NSc:i:g:s:")) != -1) {
+		switch (opt) {
+		case 'b': tty_speed = optarg; break;
+		case 'f': tty_framing = optarg; break;
+		case 'T': tty_rx_trig = atoi(optarg); break;
+		case 'N': tty_low_latency = 0; break;
+		case 'S': tty_standby = 1; break;
+		case 'c': endpoint = optarg; break;
+		case 'i': report_s = atoi(optarg); break;
+		case 'g': gap_ms = atoi(optarg); break;
+		case 's': stall_s = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
 	}
-
-	if (tty_open(argv[1]) < 0)
+	if (endpoint ? optind != argc : optind == argc)
+		usage(argv[0]);
+	if (report_s < 0 || gap_ms < 1 || stall_s < 1 || tty_rx_trig < 0)
+		usage(argv[0]);
+	if (tty_set_speed(&check, tty_speed) < 0 || tty_set_framing(&check, tty_framing) < 0) {
+		fprintf(stderr, "%s: invalid speed %s or framing %s\n", argv[0], tty_speed, tty_framing);
 		return 1;
+	}
 
-	fprintf(stderr, "Line discipline set on %s, press ^C to release the TTY...\n",
-		argv[1]);
-
+	/* Restore the lines set so far, if interrupted while setting the rest */
 	(void) signal(SIGHUP, sig_catch);
 	(void) signal(SIGINT, sig_catch);
 	(void) signal(SIGQUIT, sig_catch);
 	(void) signal(SIGTERM, sig_catch);
 
+	/* Our own pty needs no lock file, nobody else knows of it */
+	if (endpoint) {
+		if ((tty_name = pty_create()) == NULL)
+			return 1;
+		if (tty_open(tty_name, 0) < 0)
+			return 1;
+	} else {
+		for (i = optind; i < argc; i++) {
+			if (tty_open(argv[i], 1) < 0) {
+				tty_close_all();
+				return 1;
+			}
+		}
+	}
+
+	for (i = 0; i < tty_cnt; i++)
+		fprintf(stderr, "Line discipline set on %s%s\n", ttys[i].name,
+		        tty_standby && i > 0 ? ", as a standby" : "");
+	fprintf(stderr, "Press ^C to release the TTY%s...\n", tty_cnt > 1 ? "s" : "");
+
+	if (endpoint) {
+		(void) signal(SIGPIPE, SIG_IGN);
+		pump_run(endpoint, report_s, gap_ms, stall_s);
+		tty_close_all();
+		return 1;
+	}
+
 	while (pause())
 		;
 
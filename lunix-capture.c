@@ -0,0 +1,255 @@
+/*
+ * lunix-capture.c
+ *
+ * Captures the traffic of Lunix:TNG from its tap devices
+ * into a compact file, for lunix-replay, or prints
+ * a capture file in readable form.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lunix-tap.h"
+
+#define TAP_BUF_SIZE 65536
+
+static volatile sig_atomic_t done;
+
+static struct {
+	unsigned long records[LUNIX_TAP_LOST + 1];
+	unsigned long long bytes, lost;
+} stats;
+
+static FILE *out;
+static uint64_t last_ns;
+
+static void write_or_die(const void *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, out) != len) {
+		perror("fwrite");
+		exit(1);
+	}
+}
+
+/*
+ * Appends a tap record to the capture file, preceded
+ * by a record of the drops before it, if any.
+ */
+static void capture_record(const struct lunix_tap_record *rec, const unsigned char *data)
+{
+	struct lunix_cap_record cap;
+
+	if (!last_ns) {
+		struct lunix_cap_header hdr = { .start_ns = rec->ts_ns };
+
+		memcpy(hdr.magic, LUNIX_CAP_MAGIC, sizeof(hdr.magic));
+		write_or_die(&hdr, sizeof(hdr));
+		last_ns = rec->ts_ns;
+	}
+
+	cap.delta_us = ((int64_t)rec->ts_ns - (int64_t)last_ns) / 1000;
+	cap.flags = 0;
+	last_ns += (int64_t)cap.delta_us * 1000;
+
+	if (rec->lost) {
+		cap.len = sizeof(rec->lost);
+		cap.type = LUNIX_TAP_LOST;
+		write_or_die(&cap, sizeof(cap));
+		write_or_die(&rec->lost, sizeof(rec->lost));
+		cap.delta_us = 0;
+		stats.records[LUNIX_TAP_LOST]++;
+		stats.lost += rec->lost;
+	}
+
+	cap.len = rec->len;
+	cap.type = rec->type;
+	cap.flags = rec->flags;
+	write_or_die(&cap, sizeof(cap));
+	write_or_die(data, rec->len);
+
+	if (rec->type <= LUNIX_TAP_LOST)
+		stats.records[rec->type]++;
+	stats.bytes += rec->len;
+}
+
+/*
+ * Drains whatever records a tap has ready.
+ * Returns 0, or -1 on errors.
+ */
+static int capture_tap(int fd, const char *name)
+{
+	static unsigned char buf[TAP_BUF_SIZE];
+	struct lunix_tap_record rec;
+	ssize_t n, off;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		perror(name);
+		return -1;
+	}
+
+	/* Records are packed, copy their headers out to align them */
+	for (off = 0; off + (ssize_t)sizeof(rec) <= n; off += sizeof(rec) + rec.len) {
+		memcpy(&rec, buf + off, sizeof(rec));
+		capture_record(&rec, buf + off + sizeof(rec));
+	}
+
+	return 0;
+}
+
+static void print_hex(const unsigned char *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		printf("%s%02x", i % 32 ? " " : "\n    ", data[i]);
+	printf("\n");
+}
+
+/*
+ * Prints a capture file, one record per paragraph
+ */
+static int print_capture(const char *name)
+{
+	static unsigned char data[65536];
+	struct lunix_cap_header hdr;
+	struct lunix_cap_record cap;
+	uint32_t lost;
+	double t = 0;
+	FILE *f;
+
+	if (!(f = strcmp(name, "-") ? fopen(name, "rb") : stdin)) {
+		perror(name);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, LUNIX_CAP_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, "%s: not a Lunix:TNG capture file\n", name);
+		return 1;
+	}
+	printf("Capture started at %llu.%09llu\n", (unsigned long long)hdr.start_ns / 1000000000,
+	       (unsigned long long)hdr.start_ns % 1000000000);
+
+	while (fread(&cap, sizeof(cap), 1, f) == 1) {
+		if (fread(data, 1, cap.len, f) != cap.len) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			return 1;
+		}
+		t += cap.delta_us / 1e6;
+
+		switch (cap.type) {
+		case LUNIX_TAP_RAW:
+			printf("%12.6f raw    %5u bytes", t, cap.len);
+			print_hex(data, cap.len);
+			break;
+		case LUNIX_TAP_FRAME:
+			printf("%12.6f frame  %5u bytes, AM type 0x%02x, CRC %s", t, cap.len,
+			       cap.len > 4 ? data[4] : 0, (cap.flags & LUNIX_TAP_CRC_OK) ? "ok" : "BAD");
+			print_hex(data, cap.len);
+			break;
+		case LUNIX_TAP_LOST:
+			memcpy(&lost, data, sizeof(lost));
+			printf("%12.6f lost   %5u records\n", t, lost);
+			break;
+		default:
+			printf("%12.6f type %u, %u bytes\n", t, cap.type, cap.len);
+		}
+	}
+
+	return 0;
+}
+
+static void sig_done(int sig)
+{
+	done = 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [-r] [-f] [-t seconds] [-D devdir] -w capture_file\n"
+	        "       %s -p capture_file\n\n"
+	        "  -r             capture the raw bytes received, from " LUNIX_TAP_RAW_NAME "\n"
+	        "  -f             capture the frames decoded, from " LUNIX_TAP_FRAME_NAME "\n"
+	        "                 (default: both)\n"
+	        "  -t seconds     stop after this long (default: on Ctrl-C)\n"
+	        "  -D devdir      directory of the tap devices (default /dev)\n"
+	        "  -w file        write the capture to this file, - for stdout\n"
+	        "  -p file        print a capture file\n",
+	        argv0, argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *devdir = "/dev", *out_name = NULL;
+	const char *names[2] = { LUNIX_TAP_RAW_NAME, LUNIX_TAP_FRAME_NAME };
+	int want[2] = { 0, 0 };
+	struct pollfd pfd[2];
+	char path[256];
+	int opt, seconds = 0, nfds = 0, i;
+
+	while ((opt = getopt(argc, argv, "rft:D:w:p:")) != -1) {
+		switch (opt) {
+		case 'r': want[0] = 1; break;
+		case 'f': want[1] = 1; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'D': devdir = optarg; break;
+		case 'w': out_name = optarg; break;
+		case 'p': return print_capture(optarg);
+		default: usage(argv[0]);
+		}
+	}
+	if (!out_name || optind != argc)
+		usage(argv[0]);
+	if (!want[0] && !want[1])
+		want[0] = want[1] = 1;
+
+	for (i = 0; i < 2; i++) {
+		if (!want[i])
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", devdir, names[i]);
+		if ((pfd[nfds].fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
+			perror(path);
+			return 1;
+		}
+		pfd[nfds].events = POLLIN;
+		names[nfds++] = names[i];
+	}
+
+	if (!(out = strcmp(out_name, "-") ? fopen(out_name, "wb") : stdout)) {
+		perror(out_name);
+		return 1;
+	}
+
+	signal(SIGINT, sig_done);
+	signal(SIGTERM, sig_done);
+	signal(SIGALRM, sig_done);
+	if (seconds)
+		alarm(seconds);
+
+	fprintf(stderr, "Capturing to %s, Ctrl-C to stop\n", out_name);
+	while (!done) {
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		for (i = 0; i < nfds; i++)
+			if ((pfd[i].revents & POLLIN) && capture_tap(pfd[i].fd, names[i]) < 0)
+				done = 1;
+	}
+
+	fflush(out);
+	fprintf(stderr, "%lu raw records, %lu frames, %llu bytes; %llu records lost\n",
+	        stats.records[LUNIX_TAP_RAW], stats.records[LUNIX_TAP_FRAME], stats.bytes, stats.lost);
+	return 0;
+}
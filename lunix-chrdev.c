@@ -12,22 +12,32 @@
 
 #include <linux/mm.h>
 #include <linux/fs.h>
+#include <linux/uio.h>
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/cdev.h>
 #include <linux/poll.h>
+#include <linux/wait.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/timer.h>
 #include <linux/ioctl.h>
 #include <linux/types.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/mmzone.h>
 #include <linux/vmalloc.h>
+#include <linux/uaccess.h>
 #include <linux/spinlock.h>
 
 #include "lunix.h"
+#include "lunix-agg.h"
 #include "lunix-chrdev.h"
+#include "lunix-ldisc.h"
+#include "lunix-sketch.h"
+#include "lunix-stats.h"
+#include "lunix-trace.h"
 #include "lunix-lookup.h"
 
 /*
@@ -36,10 +46,118 @@
  */
 struct cdev lunix_chrdev_cdev;
 
+/*
+ * Converts a raw 16-bit measurement to thousandths of its unit
+ * using the lookup tables. Also used by the sensor code, which keeps
+ * the aggregates and sketches of the measurements in thousandths.
+ *
+ * Returns:
+ * - 0 on success
+ * - -EINVAL if an invalid measurement type is encountered
+ */
+int lunix_chrdev_convert(enum lunix_msr_enum type, uint32_t raw_data, long *value)
+{
+	switch (type) {
+	case BATT:
+		*value = lookup_voltage[raw_data];
+		break;
+	case TEMP:
+		*value = lookup_temperature[raw_data];
+		break;
+	case LIGHT:
+		*value = lookup_light[raw_data];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Checks whether a converted value moved beyond the deadband
+ * of this file since the last value delivered on it.
+ *
+ * Returns:
+ * - 1 if the value should be delivered
+ * - 0 otherwise
+ */
+static int lunix_chrdev_state_outside_deadband(struct lunix_chrdev_state_struct *state, long value)
+{
+	s64 delta;
+
+	if (!state->have_last_value)
+		return 1;
+
+	delta = abs((s64)value - state->last_value);
+
+	switch (state->deadband_mode) {
+	case LUNIX_DEADBAND_ABS:
+		return delta > state->deadband;
+	case LUNIX_DEADBAND_REL:
+		return delta * 1000 > (s64)state->deadband * abs((s64)state->last_value);
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Computes the value to deliver, in thousandths of its unit, given the
+ * sensor's latest raw value, sample count and running sum: either the
+ * latest value converted, or the average of the converted values of all
+ * the samples received since the previous delivery. Averaging after the
+ * conversion keeps it right for the nonlinear lookup tables.
+ *
+ * Returns:
+ * - 0 on success
+ * - -EINVAL if an invalid measurement type is encountered
+ */
+static int lunix_chrdev_state_value(struct lunix_chrdev_state_struct *state, uint32_t raw_data,
+                                    uint32_t cnt, s64 sum, long *value)
+{
+	uint32_t n = cnt - state->avg_cnt;
+
+	if (state->rate_mode != LUNIX_RATE_AVERAGE || n == 0)
+		return lunix_chrdev_convert(state->type, raw_data, value);
+
+	/* Unlocked callers may see a sum and a count out of step */
+	*value = div_s64(sum - state->avg_sum, n);
+	return 0;
+}
+
+/*
+ * Returns the sequence number of the oldest sample pending for this file
+ * that is still kept in the sensor's history, given the latest one.
+ */
+static uint32_t lunix_chrdev_state_first_pending(struct lunix_chrdev_state_struct *state,
+                                                 uint32_t seq)
+{
+	if (seq - state->buf_seq > LUNIX_SENSOR_HIST)
+		return seq - LUNIX_SENSOR_HIST + 1;
+
+	return state->buf_seq + 1;
+}
+
+/*
+ * Returns the time (in jiffies) at which the samples pending for a
+ * batching reader must be delivered, given the latest sequence number.
+ */
+static unsigned long lunix_chrdev_state_deadline(struct lunix_chrdev_state_struct *state,
+                                                 uint32_t seq)
+{
+	uint32_t first = lunix_chrdev_state_first_pending(state, seq);
+
+	return state->sensor->msr_hist_jiffies[state->type][first % LUNIX_SENSOR_HIST] +
+	       state->wm_timeout;
+}
+
 /*
  * Checks whether the cached character device state needs to be updated
  * from the sensor's latest measurements.
  *
+ * Also called from the sensor's wait queue when it is woken up,
+ * so it must not sleep.
+ *
  * Returns:
  * - 1 if an update is needed
  * - 0 otherwise
@@ -47,16 +165,208 @@ struct cdev lunix_chrdev_cdev;
 static int lunix_chrdev_state_needs_refresh(struct lunix_chrdev_state_struct *state)
 {
 	struct lunix_sensor_struct *sensor;
+	uint32_t seq;
+	long value;
 
 	WARN_ON(!(sensor = state->sensor));
 
 	/* Check if new data is available */
-	if (state->buf_timestamp != sensor->msr_data[state->type]->last_update)
+	seq = READ_ONCE(sensor->msr_seq[state->type]);
+	if (seq == state->buf_seq)
+		return 0;
+
+	/* Batching readers wait for their watermark instead */
+	if (state->wm_count > 1)
+		return seq - state->buf_seq >= state->wm_count ||
+		       (state->wm_timeout &&
+		        time_after_eq(jiffies, lunix_chrdev_state_deadline(state, seq)));
+
+	/* Honour the decimation factor and the minimum interval */
+	if (seq - state->buf_seq < state->decimation)
+		return 0;
+	if (state->min_interval && time_before(jiffies, state->next_jiffies))
+		return 0;
+
+	/* Aggregates have no deadband */
+	if (state->agg)
+		return 1;
+
+	/* Let lunix_chrdev_state_update() report invalid types */
+	if (lunix_chrdev_state_value(state, sensor->msr_data[state->type]->values[0],
+	                             READ_ONCE(sensor->msr_cnt[state->type]),
+	                             READ_ONCE(sensor->msr_sum[state->type]), &value) < 0)
 		return 1;
 
+	/* Ignore samples that did not move enough */
+	return lunix_chrdev_state_outside_deadband(state, value);
+}
+
+/*
+ * Checks whether data have stopped coming for the file's sensor, in a
+ * way this file has not reported yet: every feed has detached, or the
+ * node has gone stale. Does not sleep.
+ *
+ * Returns:
+ * - -ENODEV if the feeds are down
+ * - -ESTALE if the node is stale
+ * - 0 otherwise
+ */
+static int lunix_chrdev_state_event(struct lunix_chrdev_state_struct *state)
+{
+	struct lunix_sensor_struct *sensor = state->sensor;
+
+	if (READ_ONCE(lunix_sensors_feed_state) == LUNIX_FEED_DOWN) {
+		smp_rmb();
+		if (READ_ONCE(lunix_sensors_feed_downs) != state->feed_downs)
+			return -ENODEV;
+	}
+
+	if (READ_ONCE(sensor->node_state) == LUNIX_NODE_STALE &&
+	    READ_ONCE(sensor->stale_cnt) != state->stale_cnt)
+		return -ESTALE;
+
 	return 0;
 }
 
+/*
+ * Marks the events found by lunix_chrdev_state_event() as reported,
+ * so that the file goes back to waiting for data.
+ */
+static void lunix_chrdev_state_event_ack(struct lunix_chrdev_state_struct *state)
+{
+	state->feed_downs = READ_ONCE(lunix_sensors_feed_downs);
+	state->stale_cnt = READ_ONCE(state->sensor->stale_cnt);
+}
+
+/*
+ * Returns how long a reader may sleep before the minimum interval or
+ * the watermark timeout of its file expires, making pending samples
+ * deliverable.
+ */
+static long lunix_chrdev_state_timeout(struct lunix_chrdev_state_struct *state)
+{
+	unsigned long now = jiffies;
+	unsigned long deadline;
+	uint32_t seq;
+
+	if (state->wm_count > 1) {
+		seq = READ_ONCE(state->sensor->msr_seq[state->type]);
+		if (!state->wm_timeout || seq == state->buf_seq)
+			return MAX_SCHEDULE_TIMEOUT;
+
+		deadline = lunix_chrdev_state_deadline(state, seq);
+		return time_before(now, deadline) ? deadline - now : 0;
+	}
+
+	if (state->min_interval && time_before(now, state->next_jiffies))
+		return state->next_jiffies - now;
+
+	return MAX_SCHEDULE_TIMEOUT;
+}
+
+/*
+ * Appends the textual form of a converted value to the cached buffer,
+ * followed by a separator. The sign is printed apart, so that values
+ * between -1 and 0 keep theirs.
+ */
+static void lunix_chrdev_state_append(struct lunix_chrdev_state_struct *state, long value,
+                                      char sep)
+{
+	state->buf_lim += snprintf(state->buf_data + state->buf_lim,
+	                           sizeof(state->buf_data) - state->buf_lim, "%s%ld.%03ld%c",
+	                           value < 0 ? "-" : "", abs(value) / 1000, abs(value) % 1000, sep);
+}
+
+/*
+ * Updates the cached state of an aggregates file with the aggregates
+ * of its measurement, one line per window: its length in seconds, the
+ * number of samples in it, and their minimum, maximum, mean and
+ * standard deviation.
+ * Must be called with the `state->lock` semaphore held.
+ *
+ * Returns:
+ * - 0 on success
+ */
+static int lunix_chrdev_state_update_agg(struct lunix_chrdev_state_struct *state)
+{
+	struct lunix_sensor_struct *sensor = state->sensor;
+	struct lunix_agg_data_struct agg;
+	struct lunix_agg_window *w;
+	uint32_t seq;
+	int i;
+
+	spin_lock_irq(&sensor->lock);
+	seq = sensor->msr_seq[state->type];
+	state->buf_rx_time = sensor->rx_time;
+	lunix_agg_get(sensor, state->type, &agg);
+	spin_unlock_irq(&sensor->lock);
+
+	state->buf_lim = 0;
+	state->buf_seq = seq;
+	state->buf_timestamp = agg.last_update;
+	state->next_jiffies = jiffies + state->min_interval;
+
+	for (i = 0; i < LUNIX_AGG_WINDOWS; i++) {
+		w = &agg.windows[i];
+		if (!w->window_s)
+			continue;
+		state->buf_lim += snprintf(state->buf_data + state->buf_lim,
+		                           sizeof(state->buf_data) - state->buf_lim, "%u %u ",
+		                           w->window_s, w->count);
+		lunix_chrdev_state_append(state, w->min, ' ');
+		lunix_chrdev_state_append(state, w->max, ' ');
+		lunix_chrdev_state_append(state, w->mean, ' ');
+		lunix_chrdev_state_append(state, w->stddev, '\n');
+	}
+
+	return 0;
+}
+
+/*
+ * Updates the cached state of a batching reader with all the samples
+ * pending for it, one line per sample, skipping those inside its deadband.
+ * Must be called with the `state->lock` semaphore held.
+ *
+ * Returns:
+ * - 0 on success
+ * - -EAGAIN if every pending sample was filtered out
+ * - -EINVAL if an invalid measurement type is encountered
+ */
+static int lunix_chrdev_state_update_batch(struct lunix_chrdev_state_struct *state)
+{
+	struct lunix_sensor_struct *sensor = state->sensor;
+	uint16_t raw_data[LUNIX_SENSOR_HIST];
+	uint32_t first, seq, last_update, i, n;
+	long converted_value;
+	int ret;
+
+	spin_lock_irq(&sensor->lock);
+	seq = sensor->msr_seq[state->type];
+	state->buf_rx_time = sensor->rx_time;
+	first = lunix_chrdev_state_first_pending(state, seq);
+	last_update = sensor->msr_data[state->type]->last_update;
+	for (n = 0, i = first; i != seq + 1; i++)
+		raw_data[n++] = sensor->msr_hist[state->type][i % LUNIX_SENSOR_HIST];
+	spin_unlock_irq(&sensor->lock);
+
+	state->buf_lim = 0;
+	state->buf_seq = seq;
+	state->buf_timestamp = last_update;
+
+	for (i = 0; i < n; i++) {
+		if ((ret = lunix_chrdev_convert(state->type, raw_data[i], &converted_value)) < 0)
+			return ret;
+		if (!lunix_chrdev_state_outside_deadband(state, converted_value))
+			continue;
+
+		state->last_value = converted_value;
+		state->have_last_value = 1;
+		lunix_chrdev_state_append(state, converted_value, '\n');
+	}
+
+	return state->buf_lim ? 0 : -EAGAIN;
+}
+
 /*
  * Updates the cached state of the character device using sensor data.
  * Must be called with the `state->lock` semaphore held.
@@ -69,7 +379,9 @@ static int lunix_chrdev_state_needs_refresh(struct lunix_chrdev_state_struct *st
 static int lunix_chrdev_state_update(struct lunix_chrdev_state_struct *state)
 {
 	struct lunix_sensor_struct *sensor;
-	uint32_t raw_data, last_update;
+	uint32_t raw_data, last_update, seq, cnt;
+	s64 sum;
+	ktime_t rx_time;
 	long converted_value;
 	int ret = 0;
 
@@ -80,43 +392,175 @@ static int lunix_chrdev_state_update(struct lunix_chrdev_state_struct *state)
 	if (!lunix_chrdev_state_needs_refresh(state))
 		return -EAGAIN;
 
+	if (state->agg)
+		return lunix_chrdev_state_update_agg(state);
+	if (state->wm_count > 1)
+		return lunix_chrdev_state_update_batch(state);
+
 	/* Acquire the sensor's spinlock */
 	//  to protect shared resources from concurrent access in multiprocessor environments
 	spin_lock_irq(&sensor->lock);
 
-	/* Read raw sensor data and timestamp */
+	/* Read raw sensor data, timestamp and sample accounting */
 	raw_data = sensor->msr_data[state->type]->values[0];
 	last_update = sensor->msr_data[state->type]->last_update;
+	seq = sensor->msr_seq[state->type];
+	cnt = sensor->msr_cnt[state->type];
+	sum = sensor->msr_sum[state->type];
+	rx_time = sensor->rx_time;
 
 	/* Release the spinlock */
 	spin_unlock_irq(&sensor->lock);
 	// Ensures that other threads or interrupt handlers waiting to acquire the lock can proceed.
 
-	/* Update the cached timestamp */
+	/* Convert raw data using the lookup tables */
+	if ((ret = lunix_chrdev_state_value(state, raw_data, cnt, sum, &converted_value)) < 0)
+		return ret;
+
+	/* The value may have moved back inside the deadband meanwhile */
+	if (!lunix_chrdev_state_outside_deadband(state, converted_value))
+		return -EAGAIN;
+
+	/* Update the cached timestamp and the last value delivered */
 	state->buf_timestamp = last_update;
+	state->buf_seq = seq;
+	state->buf_rx_time = rx_time;
+	state->last_value = converted_value;
+	state->have_last_value = 1;
 
-	/* Convert raw data using the lookup tables */
-	switch (state->type) {
-	case BATT:
-		converted_value = lookup_voltage[raw_data];
-		break;
-	case TEMP:
-		converted_value = lookup_temperature[raw_data];
-		break;
-	case LIGHT:
-		converted_value = lookup_light[raw_data];
-		break;
-	default:
-		return -EINVAL;
-	}
+	/* Start a new rate limiting period */
+	state->avg_cnt = cnt;
+	state->avg_sum = sum;
+	state->next_jiffies = jiffies + state->min_interval;
 
 	/* Format the converted data and store it in state->buf_data */
-	state->buf_lim = snprintf(state->buf_data, LUNIX_CHRDEV_BUFSZ, "%ld.%03ld\n",
-	                          converted_value / 1000, abs(converted_value % 1000));
+	state->buf_lim = 0;
+	lunix_chrdev_state_append(state, converted_value, '\n');
 
 	return ret;
 }
 
+/*
+ * A wait queue entry carrying the state of the reader that sleeps on it,
+ * so that the sensor's wakeups can be filtered in the waker's context.
+ */
+struct lunix_chrdev_waiter {
+	struct wait_queue_entry wq_entry;
+	struct lunix_chrdev_state_struct *state;
+	long timeout;
+};
+
+/*
+ * Checks whether a batching reader with a watermark timeout has samples
+ * pending, so that its deadline is set, given whether one already is.
+ * Its sleepers must then be woken up, or its poll timer armed, even
+ * though the watermark is not reached yet: nothing else would make
+ * them see the deadline.
+ */
+static int lunix_chrdev_state_wm_arm(struct lunix_chrdev_state_struct *state, int armed)
+{
+	return state->wm_count > 1 && state->wm_timeout && !armed &&
+	       READ_ONCE(state->sensor->msr_seq[state->type]) != state->buf_seq;
+}
+
+/*
+ * Called for every sleeping reader when the sensor is updated, its
+ * node goes stale or the feeds go down. Readers whose filters reject
+ * the new sample are not woken up at all, but for batching readers
+ * sleeping without a deadline, which the sample may have just set.
+ */
+static int lunix_chrdev_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode,
+                                      int sync, void *key)
+{
+	struct lunix_chrdev_waiter *waiter;
+
+	waiter = container_of(wq_entry, struct lunix_chrdev_waiter, wq_entry);
+	if (!lunix_chrdev_state_needs_refresh(waiter->state) &&
+	    !lunix_chrdev_state_event(waiter->state) &&
+	    !lunix_chrdev_state_wm_arm(waiter->state,
+	                               READ_ONCE(waiter->timeout) != MAX_SCHEDULE_TIMEOUT)) {
+		lunix_stat_inc(LUNIX_STAT_READER_FILTERED);
+		return 0;
+	}
+
+	trace_lunix_reader_wake(waiter->state->sensor - lunix_sensors, waiter->state->type);
+	lunix_stat_inc(LUNIX_STAT_READER_WAKEUPS);
+	return autoremove_wake_function(wq_entry, mode, sync, key);
+}
+
+/*
+ * Sleeps on the sensor's wait queue until there is data worth delivering,
+ * or the end of the data to report.
+ * Must be called without the `state->lock` semaphore held.
+ *
+ * Returns:
+ * - 0 when new data is available, or the feeds or the node went silent
+ * - -ERESTARTSYS if interrupted by a signal
+ */
+static int lunix_chrdev_wait(struct lunix_chrdev_state_struct *state)
+{
+	struct lunix_chrdev_waiter waiter = { .state = state, .timeout = MAX_SCHEDULE_TIMEOUT };
+	struct lunix_sensor_struct *sensor = state->sensor;
+	int ret = 0;
+
+	init_wait_entry(&waiter.wq_entry, 0);
+	waiter.wq_entry.func = lunix_chrdev_wake_function;
+
+	for (;;) {
+		prepare_to_wait(&sensor->wq, &waiter.wq_entry, TASK_INTERRUPTIBLE);
+		if (lunix_chrdev_state_needs_refresh(state) || lunix_chrdev_state_event(state))
+			break;
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		/* A sleeper with a deadline need not be woken up to learn of it */
+		WRITE_ONCE(waiter.timeout, lunix_chrdev_state_timeout(state));
+		schedule_timeout(waiter.timeout);
+	}
+	finish_wait(&sensor->wq, &waiter.wq_entry);
+
+	return ret;
+}
+
+/*
+ * Called for every file being polled when the sensor is updated, its
+ * node goes stale or the feeds go down. As for sleeping readers, the
+ * processes polling on a file whose filters reject the new sample are
+ * not woken up at all.
+ */
+static int lunix_chrdev_poll_wake_function(struct wait_queue_entry *wq_entry, unsigned int mode,
+                                           int sync, void *key)
+{
+	struct lunix_chrdev_state_struct *state;
+
+	state = container_of(wq_entry, struct lunix_chrdev_state_struct, poll_entry);
+	if (!lunix_chrdev_state_needs_refresh(state) && !lunix_chrdev_state_event(state)) {
+		/* The first sample of a batch sets its deadline */
+		if (lunix_chrdev_state_wm_arm(state, timer_pending(&state->poll_timer)))
+			mod_timer(&state->poll_timer, lunix_chrdev_state_deadline(state,
+			          READ_ONCE(state->sensor->msr_seq[state->type])));
+		lunix_stat_inc(LUNIX_STAT_READER_FILTERED);
+		return 0;
+	}
+
+	trace_lunix_reader_wake(state->sensor - lunix_sensors, state->type);
+	lunix_stat_inc(LUNIX_STAT_READER_WAKEUPS);
+	wake_up_interruptible(&state->poll_wq);
+	return 0;
+}
+
+/*
+ * Wakes up the processes polling on a file when one of
+ * its rate limit or watermark deadlines expires.
+ */
+static void lunix_chrdev_poll_timer(struct timer_list *t)
+{
+	struct lunix_chrdev_state_struct *state = from_timer(state, t, poll_timer);
+
+	wake_up_interruptible(&state->poll_wq);
+}
+
 /*************************************
  * Character device file operations
  *************************************/
@@ -142,8 +586,8 @@ static int lunix_chrdev_open(struct inode *inode, struct file *filp)
 	type = minor_num % 8;      /* Measurement type */
 	sensor_num = minor_num / 8; /* Sensor number */
 
-    /* Validate measurement type */
-	if (type >= N_LUNIX_MSR) {
+    /* Validate measurement type, or that of the aggregates */
+	if (type >= LUNIX_CHRDEV_AGG + N_LUNIX_MSR) {
 		ret = -EINVAL;
 		goto out;
 	}
@@ -157,10 +601,37 @@ static int lunix_chrdev_open(struct inode *inode, struct file *filp)
 	}
 
     /* Initialize the device state */
-	state->type = type;
+	state->agg = type >= LUNIX_CHRDEV_AGG;
+	state->type = state->agg ? type - LUNIX_CHRDEV_AGG : type;
 	state->sensor = &lunix_sensors[sensor_num];
 	state->buf_lim = 0;
 	state->buf_timestamp = 0;
+	state->buf_seq = 0;
+	state->buf_rx_time = 0;
+	state->deadband_mode = LUNIX_DEADBAND_NONE;
+	state->deadband = 0;
+	state->last_value = 0;
+	state->have_last_value = 0;
+	state->rate_mode = LUNIX_RATE_LATEST;
+	state->decimation = 0;
+	state->min_interval = 0;
+	state->next_jiffies = jiffies;
+	state->avg_cnt = 0;
+	state->avg_sum = 0;
+	state->wm_count = 0;
+	state->wm_timeout = 0;
+
+	/* Feeds already down or a node already stale are reported by the first read */
+	state->stale_cnt = state->sensor->stale_cnt;
+	if (state->sensor->node_state == LUNIX_NODE_STALE)
+		state->stale_cnt--;
+	state->feed_downs = lunix_sensors_feed_downs;
+	if (lunix_sensors_feed_state == LUNIX_FEED_DOWN)
+		state->feed_downs--;
+	init_waitqueue_head(&state->poll_wq);
+	timer_setup(&state->poll_timer, lunix_chrdev_poll_timer, 0);
+	init_waitqueue_func_entry(&state->poll_entry, lunix_chrdev_poll_wake_function);
+	INIT_LIST_HEAD(&state->poll_entry.entry);
 	sema_init(&state->lock, 1);
 	// state->lock will protect the state object or associated data from concurrent access by multiple threads or processes
 	// A value of 1 means the resource is available.
@@ -180,34 +651,267 @@ out:
  */
 static int lunix_chrdev_release(struct inode *inode, struct file *filp)
 {
-	kfree(filp->private_data);
+	struct lunix_chrdev_state_struct *state = filp->private_data;
+
+	if (!list_empty(&state->poll_entry.entry))
+		remove_wait_queue(&state->sensor->wq, &state->poll_entry);
+	timer_delete_sync(&state->poll_timer);
+	kfree(state);
 	debug("released private data successfully\n");
 	return 0;
 }
 
+/*
+ * Merges the sketches of the sensors asked for by LUNIX_IOC_QUANTILES
+ * and computes the quantiles asked for from them.
+ * Must be called with the `state->lock` semaphore held.
+ *
+ * Returns:
+ * - 0 on success
+ * - -EFAULT if the list of sensors is not accessible
+ * - -EINVAL for a bad request, or sensor numbers out of range or repeated
+ * - -ENOMEM if out of memory
+ */
+static long lunix_chrdev_quantiles(struct lunix_chrdev_state_struct *state,
+                                   struct lunix_ioc_quantiles *qs)
+{
+	struct lunix_sketch *sk;
+	uint32_t own, *nodes = &own;
+	unsigned int i;
+	long ret;
+
+	if (qs->nr_quantiles > LUNIX_QUANTILES_MAX || qs->nr_nodes > lunix_sensor_cnt ||
+	    (qs->flags & ~LUNIX_QUANTILES_RESET) || qs->pad)
+		return -EINVAL;
+	for (i = 0; i < qs->nr_quantiles; i++)
+		if (qs->quantiles[i] > 1000)
+			return -EINVAL;
+
+	own = state->sensor - lunix_sensors;
+	if (qs->nr_nodes) {
+		nodes = memdup_user(u64_to_user_ptr(qs->nodes), qs->nr_nodes * sizeof(*nodes));
+		if (IS_ERR(nodes))
+			return PTR_ERR(nodes);
+	}
+
+	sk = kmalloc(sizeof(*sk), GFP_KERNEL);
+	if (!sk) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = lunix_sketch_collect(sk, state->type, nodes, qs->nr_nodes ? qs->nr_nodes : 1,
+	                           qs->flags & LUNIX_QUANTILES_RESET);
+	if (ret < 0)
+		goto out_with_sketch;
+
+	for (i = 0; i < qs->nr_quantiles; i++)
+		qs->values[i] = lunix_sketch_quantile(sk, qs->quantiles[i]);
+	qs->count = sk->count;
+	qs->min = sk->count ? sk->min : 0;
+	qs->max = sk->count ? sk->max : 0;
+
+out_with_sketch:
+	kfree(sk);
+out:
+	if (nodes != &own)
+		kfree(nodes);
+	return ret;
+}
+
 /*
  * Handles IOCTL commands for the character device.
- * Currently, no IOCTL commands are supported.
  *
  * Returns:
- * - -EINVAL (Invalid argument)
+ * - 0 on success
+ * - -EFAULT if the user buffer is not accessible
+ * - -EINVAL (Invalid argument) for unknown commands or settings
+ * - -EPERM, -ENODEV or -EAGAIN if a node command cannot be sent
+ * - -ENOMEM if out of memory for merging sketches
  */
 static long lunix_chrdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-	/* No ioctl commands are supported */
-	return -EINVAL;
+	struct lunix_chrdev_state_struct *state;
+	void __user *uarg = (void __user *)arg;
+	struct lunix_ioc_deadband db;
+	struct lunix_ioc_rate rate;
+	struct lunix_ioc_watermark wm;
+	struct lunix_ioc_xcommand xc;
+	struct lunix_ioc_status st;
+	struct lunix_agg_data_struct agg;
+	struct lunix_ioc_quantiles qs;
+	struct lunix_sensor_struct *sensor;
+	unsigned long age;
+	long ret = 0;
+
+	if (_IOC_TYPE(cmd) != LUNIX_IOC_MAGIC || _IOC_NR(cmd) > LUNIX_IOC_MAXNR)
+		return -EINVAL;
+
+	state = filp->private_data;
+	WARN_ON(!state);
+
+	if (down_interruptible(&state->lock))
+		return -ERESTARTSYS;
+
+	switch (cmd) {
+	case LUNIX_IOC_SET_DEADBAND:
+		if (copy_from_user(&db, uarg, sizeof(db))) {
+			ret = -EFAULT;
+			break;
+		}
+		/* Aggregates files take no deadband */
+		if (db.mode > LUNIX_DEADBAND_REL || (state->agg && db.mode != LUNIX_DEADBAND_NONE)) {
+			ret = -EINVAL;
+			break;
+		}
+		state->deadband_mode = db.mode;
+		state->deadband = db.threshold;
+		break;
+
+	case LUNIX_IOC_GET_DEADBAND:
+		db.mode = state->deadband_mode;
+		db.threshold = state->deadband;
+		if (copy_to_user(uarg, &db, sizeof(db)))
+			ret = -EFAULT;
+		break;
+
+	case LUNIX_IOC_SET_RATE:
+		if (copy_from_user(&rate, uarg, sizeof(rate))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (rate.mode > LUNIX_RATE_AVERAGE || (state->agg && rate.mode != LUNIX_RATE_LATEST)) {
+			ret = -EINVAL;
+			break;
+		}
+		state->rate_mode = rate.mode;
+		state->decimation = rate.decimation;
+		state->min_interval = msecs_to_jiffies(rate.interval_ms);
+		state->next_jiffies = jiffies + state->min_interval;
+
+		/* Average over the samples received from now on */
+		spin_lock_irq(&state->sensor->lock);
+		state->avg_cnt = state->sensor->msr_cnt[state->type];
+		state->avg_sum = state->sensor->msr_sum[state->type];
+		spin_unlock_irq(&state->sensor->lock);
+		break;
+
+	case LUNIX_IOC_GET_RATE:
+		rate.mode = state->rate_mode;
+		rate.decimation = state->decimation;
+		rate.interval_ms = jiffies_to_msecs(state->min_interval);
+		if (copy_to_user(uarg, &rate, sizeof(rate)))
+			ret = -EFAULT;
+		break;
+
+	case LUNIX_IOC_SET_WATERMARK:
+		if (copy_from_user(&wm, uarg, sizeof(wm))) {
+			ret = -EFAULT;
+			break;
+		}
+		/* Cannot batch more samples than the sensor keeps, nor aggregates */
+		if (wm.count > LUNIX_SENSOR_HIST || (state->agg && wm.count > 1)) {
+			ret = -EINVAL;
+			break;
+		}
+		state->wm_count = wm.count;
+		state->wm_timeout = msecs_to_jiffies(wm.timeout_ms);
+
+		/* Batch the samples received from now on, not the history */
+		if (state->wm_count > 1) {
+			spin_lock_irq(&state->sensor->lock);
+			state->buf_seq = state->sensor->msr_seq[state->type];
+			spin_unlock_irq(&state->sensor->lock);
+		}
+		break;
+
+	case LUNIX_IOC_GET_WATERMARK:
+		wm.count = state->wm_count;
+		wm.timeout_ms = jiffies_to_msecs(state->wm_timeout);
+		if (copy_to_user(uarg, &wm, sizeof(wm)))
+			ret = -EFAULT;
+		break;
+
+	case LUNIX_IOC_XCOMMAND:
+		/* Reconfigures the node, for every reader of its sensor */
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		if (copy_from_user(&xc, uarg, sizeof(xc))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (xc.pad) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = lunix_ldisc_xcommand(state->sensor - lunix_sensors + 1, xc.cmd, xc.arg);
+		break;
+
+	case LUNIX_IOC_GET_STATUS:
+		sensor = state->sensor;
+		spin_lock_irq(&sensor->lock);
+		st.flags = 0;
+		if (sensor->node_state == LUNIX_NODE_STALE)
+			st.flags |= LUNIX_STATUS_STALE;
+		if (sensor->node_state == LUNIX_NODE_UNSEEN)
+			st.flags |= LUNIX_STATUS_UNSEEN;
+		st.stale_cnt = sensor->stale_cnt;
+		st.last_update = sensor->msr_data[state->type]->last_update;
+		age = jiffies - sensor->last_seen;
+		spin_unlock_irq(&sensor->lock);
+
+		st.age_ms = 0;
+		if (!(st.flags & LUNIX_STATUS_UNSEEN))
+			st.age_ms = min_t(u64, jiffies_to_msecs(age), U32_MAX);
+		if (copy_to_user(uarg, &st, sizeof(st)))
+			ret = -EFAULT;
+		break;
+
+	case LUNIX_IOC_GET_AGG:
+		spin_lock_irq(&state->sensor->lock);
+		lunix_agg_get(state->sensor, state->type, &agg);
+		spin_unlock_irq(&state->sensor->lock);
+
+		if (copy_to_user(uarg, &agg, sizeof(agg)))
+			ret = -EFAULT;
+		break;
+
+	case LUNIX_IOC_QUANTILES:
+		if (copy_from_user(&qs, uarg, sizeof(qs))) {
+			ret = -EFAULT;
+			break;
+		}
+		if ((ret = lunix_chrdev_quantiles(state, &qs)) < 0)
+			break;
+		if (copy_to_user(uarg, &qs, sizeof(qs)))
+			ret = -EFAULT;
+		break;
+
+	default:
+		ret = -EINVAL;
+	}
+
+	up(&state->lock);
+	return ret;
 }
 
 
 /*
- * Reads data from the character device into the user buffer.
+ * Reads data from the character device into the destination iterator,
+ * for read(2) from userspace and kernel_read() from within the kernel alike.
  */
-static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t cnt, loff_t *f_pos)
+static ssize_t lunix_chrdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
 	ssize_t ret = 0;
+	struct file *filp = iocb->ki_filp;
 	struct lunix_chrdev_state_struct *state;
 	struct lunix_sensor_struct *sensor;
 	ssize_t available_bytes;
+	size_t cnt = iov_iter_count(to);
+	ktime_t running, slept, woken, now;
+	int refreshed = 0;
 
 	state = filp->private_data;
 	WARN_ON(!state);
@@ -215,28 +919,51 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 	sensor = state->sensor;
 	WARN_ON(!sensor);
 
+	lunix_stat_inc(LUNIX_STAT_READS);
+	running = lunix_latency_now();
+
     /* Acquire the state lock */
 	// Attempt to acquire the semaphore (state->lock) to prevent concurrent access to the device state.
 	if (down_interruptible(&state->lock))
 		return -ERESTARTSYS;
 
 	/* Update state if necessary */
-	if (*f_pos == 0) {
+	if (iocb->ki_pos == 0) {
 		while (lunix_chrdev_state_update(state) == -EAGAIN) { // refresh the device state
+			/* Nothing new because the feeds or the node went silent: say so, once */
+			if ((ret = lunix_chrdev_state_event(state)) < 0) {
+				lunix_chrdev_state_event_ack(state);
+				goto out;
+			}
+
+			/* Do not block if the file was opened with O_NONBLOCK */
+			if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
+				ret = -EAGAIN;
+				goto out;
+			}
+
 			// Releases the lock
 			up(&state->lock);
 
 			/* Wait until new data is available */
-			if (wait_event_interruptible(sensor->wq, lunix_chrdev_state_needs_refresh(state)))
+			slept = lunix_latency_now();
+			if (lunix_chrdev_wait(state))
 				return -ERESTARTSYS;
 
+			/* Account for the scheduling delay, if a sensor update woke us up */
+			running = lunix_latency_now();
+			woken = READ_ONCE(sensor->wake_time);
+			if (ktime_after(woken, slept))
+				lunix_latency_since(LUNIX_LAT_SCHED, woken, running);
+
 			if (down_interruptible(&state->lock))
 				return -ERESTARTSYS;
 		}
+		refreshed = 1;
 	}
 
 	/* Determine the number of bytes to copy */
-	available_bytes = state->buf_lim - *f_pos;  // number of bytes available for reading
+	available_bytes = state->buf_lim - iocb->ki_pos;  // number of bytes available for reading
 	if (available_bytes < 0)
 		available_bytes = 0;
 
@@ -249,18 +976,25 @@ static ssize_t lunix_chrdev_read(struct file *filp, char __user *usrbuf, size_t
 		goto out;
 	}
 
-	/* Copy data to user-space */
-	if (copy_to_user(usrbuf, state->buf_data + *f_pos, cnt)) {
+	/* Copy data to the destination, in user or kernel space */
+	if (copy_to_iter(state->buf_data + iocb->ki_pos, cnt, to) != cnt) {
 		ret = -EFAULT;
 		goto out;
 	}
 
-	*f_pos += cnt;
+	iocb->ki_pos += cnt;
 	ret = cnt;
+	trace_lunix_chrdev_read(sensor - lunix_sensors, state->type, state->buf_seq, cnt);
+	if (refreshed && lunix_latency_enabled()) {
+		now = ktime_get();
+		lunix_latency_since(LUNIX_LAT_COPY, running, now);
+		lunix_latency_since(LUNIX_LAT_E2E, state->buf_rx_time, now);
+	}
+	lunix_stat_add(LUNIX_STAT_READ_BYTES, cnt);
 
 	/* Auto-rewind on EOF */
-	if (*f_pos >= state->buf_lim)
-		*f_pos = 0;
+	if (iocb->ki_pos >= state->buf_lim)
+		iocb->ki_pos = 0;
 
 out:
 	up(&state->lock); // Releases the lock
@@ -269,12 +1003,75 @@ out:
 
 
 /*
- * Memory mapping is not supported for the character device.
+ * Reports whether a read would block. Pollers wait on the file's own
+ * queue, which the file's entry on the sensor's wait queue wakes up
+ * only for samples its filters let through, so that deadbands, rate
+ * limits and watermarks spare them wakeups as they do blocking readers.
+ * Readers with pending samples held back by a rate limit or a watermark
+ * get woken up by a timer when the relevant deadline expires.
+ */
+static __poll_t lunix_chrdev_poll(struct file *filp, poll_table *wait)
+{
+	struct lunix_chrdev_state_struct *state;
+	long timeout;
+
+	state = filp->private_data;
+	WARN_ON(!state);
+
+	poll_wait(filp, &state->poll_wq, wait);
+
+	/* Watch the sensor for this file from its first poll on */
+	spin_lock_irq(&state->sensor->wq.lock);
+	if (list_empty(&state->poll_entry.entry))
+		__add_wait_queue(&state->sensor->wq, &state->poll_entry);
+	spin_unlock_irq(&state->sensor->wq.lock);
+
+	/* Data left over from a partial read, or a fresh sample */
+	if (filp->f_pos != 0 || lunix_chrdev_state_needs_refresh(state))
+		return EPOLLIN | EPOLLRDNORM;
+
+	/* The end of the data to report, which the next read does */
+	switch (lunix_chrdev_state_event(state)) {
+	case -ENODEV:
+		return EPOLLIN | EPOLLRDNORM | EPOLLHUP;
+	case -ESTALE:
+		return EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+	}
+
+	timeout = lunix_chrdev_state_timeout(state);
+	if (timeout != MAX_SCHEDULE_TIMEOUT)
+		mod_timer(&state->poll_timer, jiffies + timeout);
+
+	return 0;
+}
+
+
+/*
+ * Maps the page of the file's measurement, read-only: the latest raw
+ * value, its timestamp and the stale flag, readable without a system
+ * call. The mapping follows the page as the sensor updates it. For an
+ * aggregates file, the page is that of the aggregates instead.
  */
 static int lunix_chrdev_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	/* Memory mapping is not supported */
-	return -EINVAL;
+	struct lunix_chrdev_state_struct *state;
+	void *page;
+
+	state = filp->private_data;
+	WARN_ON(!state);
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (state->agg)
+		page = state->sensor->agg->agg_data[state->type];
+	else
+		page = state->sensor->msr_data[state->type];
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(page));
 }
 
 
@@ -285,8 +1082,10 @@ static const struct file_operations lunix_chrdev_fops = {
 	.owner          = THIS_MODULE,
 	.open           = lunix_chrdev_open,
 	.release        = lunix_chrdev_release,
-	.read           = lunix_chrdev_read,
+	.read_iter      = lunix_chrdev_read_iter,
+	.poll           = lunix_chrdev_poll,
 	.unlocked_ioctl = lunix_chrdev_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
 	.mmap           = lunix_chrdev_mmap,
 };
 
@@ -12,7 +12,13 @@
  * Lunix:TNG character device
  */
 #define LUNIX_CHRDEV_MAJOR 60   /* Reserved for local / experimental use */
-#define LUNIX_CHRDEV_BUFSZ 20   /* Buffer size used to hold textual info */
+#define LUNIX_CHRDEV_BUFSZ 20   /* Buffer size used to hold the textual form of a sample */
+
+/*
+ * Minor numbers are sensor * 8 + type. Types 0-2 are the battery,
+ * temperature and light measurements, types 3-5 their aggregates.
+ */
+#define LUNIX_CHRDEV_AGG 3      /* Type of the first aggregates file */
 
 /* Compile-time parameters */
 
@@ -30,17 +36,70 @@
 struct lunix_chrdev_state_struct {
 	enum lunix_msr_enum type;
 	struct lunix_sensor_struct *sensor;
+	int agg;                        /* Reads the aggregates of the measurement, not its samples */
 
-	/* A buffer used to hold cached textual info */
+	/* A buffer used to hold cached textual info, one line per sample */
 	int buf_lim;
-	unsigned char buf_data[LUNIX_CHRDEV_BUFSZ];
+	unsigned char buf_data[LUNIX_CHRDEV_BUFSZ * LUNIX_SENSOR_HIST];
 	uint32_t buf_timestamp;
+	uint32_t buf_seq;               /* Sensor sequence number of the cached sample */
+	ktime_t buf_rx_time;            /* When its packet started arriving, if known */
 
 	struct semaphore lock;
 
 	/*
-	 * Fixme: Any mode settings? e.g. blocking vs. non-blocking
+	 * Deadband (change threshold) filtering: a sample is only
+	 * considered new if its converted value moved beyond the
+	 * threshold since the last value delivered on this file.
 	 */
+	uint32_t deadband_mode;
+	uint32_t deadband;
+	long last_value;
+	int have_last_value;
+
+	/*
+	 * Rate limiting: deliver at most one of every `decimation` samples,
+	 * no sooner than `min_interval` jiffies after the previous one.
+	 * In LUNIX_RATE_AVERAGE mode the samples received meanwhile are
+	 * averaged, starting from sample count `avg_cnt` and running sum
+	 * `avg_sum` of the sensor.
+	 */
+	uint32_t rate_mode;
+	uint32_t decimation;
+	unsigned long min_interval;
+	unsigned long next_jiffies;
+	uint32_t avg_cnt;
+	s64 avg_sum;
+
+	/*
+	 * Wakeup watermark: when `wm_count` is above one, a read blocks
+	 * until that many samples are pending, or until the oldest pending
+	 * sample is `wm_timeout` jiffies old, and returns them all.
+	 */
+	uint32_t wm_count;
+	unsigned long wm_timeout;
+
+	/*
+	 * The sensor's `stale_cnt` when its node last went stale, and
+	 * `lunix_sensors_feed_downs` when the feeds last went down, as
+	 * reported on this file
+	 */
+	uint32_t stale_cnt;
+	uint32_t feed_downs;
+
+	/*
+	 * Woken up by `poll_timer` when a rate limit or watermark
+	 * deadline expires, for processes polling on the file.
+	 */
+	wait_queue_head_t poll_wq;
+	struct timer_list poll_timer;
+
+	/*
+	 * Sits on the sensor's wait queue from the first poll on the
+	 * file until it is released, passing on to `poll_wq` only the
+	 * wakeups the file's filters let through.
+	 */
+	struct wait_queue_entry poll_entry;
 };
 
 /*
@@ -48,17 +107,132 @@ struct lunix_chrdev_state_struct {
  */
 int lunix_chrdev_init(void);
 void lunix_chrdev_destroy(void);
+int lunix_chrdev_convert(enum lunix_msr_enum type, uint32_t raw_data, long *value);
 
+#else
+#include <inttypes.h>
+#include "lunix.h"
 #endif /* __KERNEL__ */
 
 #include <linux/ioctl.h>
 
+/*
+ * Deadband modes. An absolute threshold is expressed in thousandths
+ * of the measurement unit, i.e. the fixed-point scale of the lookup
+ * tables. A relative threshold is expressed in thousandths (per mille)
+ * of the last value delivered on the file.
+ */
+#define LUNIX_DEADBAND_NONE 0
+#define LUNIX_DEADBAND_ABS  1
+#define LUNIX_DEADBAND_REL  2
+
+struct lunix_ioc_deadband {
+	uint32_t mode;
+	uint32_t threshold;
+};
+
+/*
+ * Rate limiting modes: deliver the latest sample, or the
+ * average of all the samples received since the previous one.
+ */
+#define LUNIX_RATE_LATEST   0
+#define LUNIX_RATE_AVERAGE  1
+
+struct lunix_ioc_rate {
+	uint32_t interval_ms;   /* Minimum time between samples delivered, 0 disables */
+	uint32_t decimation;    /* Deliver one of every N samples, 0 or 1 disables */
+	uint32_t mode;
+};
+
+/*
+ * Wakeup watermark: wake the reader once `count` samples are pending,
+ * or `timeout_ms` after the first of them arrived, whichever comes first.
+ * A count of 0 or 1 disables batching, a timeout of 0 disables the bound.
+ */
+struct lunix_ioc_watermark {
+	uint32_t count;
+	uint32_t timeout_ms;
+};
+
+/*
+ * A command for the node of the file's sensor, sent down through the
+ * base station as an XMesh XCommand packet. The commands are those
+ * of XMesh; the argument is command-specific, e.g. the new sampling
+ * and reporting period of the node, in ms, for LUNIX_XCMD_SET_RATE.
+ */
+#define LUNIX_XCMD_RESET    0x10
+#define LUNIX_XCMD_SET_RATE 0x20
+#define LUNIX_XCMD_SLEEP    0x30
+#define LUNIX_XCMD_WAKEUP   0x31
+
+struct lunix_ioc_xcommand {
+	uint16_t cmd;
+	uint16_t pad;           /* Must be zero */
+	uint32_t arg;
+};
+
+/*
+ * Liveness of the file's node, and of its measurement. The age is
+ * the time since the node was last heard from, in ms, and saturates;
+ * it is 0 for a node never heard from. The stale count is the number
+ * of times the node went stale since the module was loaded.
+ */
+#define LUNIX_STATUS_STALE  0x1 /* Silent for longer than the stale timeout */
+#define LUNIX_STATUS_UNSEEN 0x2 /* Never heard from */
+
+struct lunix_ioc_status {
+	uint32_t flags;
+	uint32_t stale_cnt;
+	uint32_t age_ms;
+	uint32_t last_update;   /* Of the measurement, as in its page */
+};
+
+/*
+ * LUNIX_IOC_GET_AGG returns the aggregates of the file's measurement,
+ * in the layout of their page (see lunix.h), with the windows slid
+ * forward to the current time.
+ */
+
+/*
+ * Quantiles of the file's measurement, from the sketches of a set of
+ * sensors merged together: those of `nr_nodes` sensor numbers (as in
+ * the minor numbers) at the user address `nodes`, or the file's own
+ * if `nr_nodes` is 0. The quantiles asked for are in per mille (e.g.
+ * 990 for p99), the values returned in thousandths of the unit, as are
+ * the exact minimum and maximum. With LUNIX_QUANTILES_RESET, the
+ * sketches are emptied as they are read, to start a new interval.
+ */
+#define LUNIX_QUANTILES_MAX   8
+#define LUNIX_QUANTILES_RESET 0x1
+
+struct lunix_ioc_quantiles {
+	uint64_t nodes;
+	uint32_t nr_nodes;
+	uint32_t flags;
+	uint32_t nr_quantiles;
+	uint32_t quantiles[LUNIX_QUANTILES_MAX];
+	int32_t values[LUNIX_QUANTILES_MAX];
+	uint32_t pad;           /* Must be zero */
+	uint64_t count;         /* Of the values sketched */
+	int32_t min;
+	int32_t max;
+};
+
 /*
  * Definition of ioctl commands
  */
 #define LUNIX_IOC_MAGIC     LUNIX_CHRDEV_MAJOR
-//#define LUNIX_IOC_EXAMPLE _IOR(LUNIX_IOC_MAGIC, 0, void *)
-
-#define LUNIX_IOC_MAXNR 0
+#define LUNIX_IOC_SET_DEADBAND _IOW(LUNIX_IOC_MAGIC, 0, struct lunix_ioc_deadband)
+#define LUNIX_IOC_GET_DEADBAND _IOR(LUNIX_IOC_MAGIC, 1, struct lunix_ioc_deadband)
+#define LUNIX_IOC_SET_RATE     _IOW(LUNIX_IOC_MAGIC, 2, struct lunix_ioc_rate)
+#define LUNIX_IOC_GET_RATE     _IOR(LUNIX_IOC_MAGIC, 3, struct lunix_ioc_rate)
+#define LUNIX_IOC_SET_WATERMARK _IOW(LUNIX_IOC_MAGIC, 4, struct lunix_ioc_watermark)
+#define LUNIX_IOC_GET_WATERMARK _IOR(LUNIX_IOC_MAGIC, 5, struct lunix_ioc_watermark)
+#define LUNIX_IOC_XCOMMAND     _IOW(LUNIX_IOC_MAGIC, 6, struct lunix_ioc_xcommand)
+#define LUNIX_IOC_GET_STATUS   _IOR(LUNIX_IOC_MAGIC, 7, struct lunix_ioc_status)
+#define LUNIX_IOC_GET_AGG      _IOR(LUNIX_IOC_MAGIC, 8, struct lunix_agg_data_struct)
+#define LUNIX_IOC_QUANTILES    _IOWR(LUNIX_IOC_MAGIC, 9, struct lunix_ioc_quantiles)
+
+#define LUNIX_IOC_MAXNR 9
 
 #endif /* _LUNIX_H */
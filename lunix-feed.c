@@ -0,0 +1,131 @@
+/*
+ * lunix-feed.c
+ *
+ * Feed device for Lunix:TNG: XMesh data written to /dev/lunix-feed
+ * go straight to a protocol parser, skipping the pty, the TTY flip
+ * buffers and the line discipline that a serial line goes through.
+ */
+
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/miscdevice.h>
+
+#include "lunix.h"
+#include "lunix-feed.h"
+#include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+
+static int lunix_feed_open(struct inode *inode, struct file *filp)
+{
+	struct lunix_feed_state_struct *state;
+	int ret;
+
+	/* Feeding the sensors is as privileged as attaching the line discipline */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if ((ret = nonseekable_open(inode, filp)) < 0)
+		return ret;
+
+	state = kmalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return -ENOMEM;
+
+	mutex_init(&state->lock);
+	lunix_protocol_init(&state->proto);
+	filp->private_data = state;
+	lunix_sensor_feed_attach();
+
+	debug("feed opened\n");
+	return 0;
+}
+
+static int lunix_feed_release(struct inode *inode, struct file *filp)
+{
+	kfree(filp->private_data);
+	lunix_sensor_feed_detach();
+	debug("feed released\n");
+	return 0;
+}
+
+/*
+ * Copies the data written, a chunk at a time, and parses them.
+ * Also serves splice() and vmsplice(), through iter_file_splice_write(),
+ * so that data already in a pipe are only copied once, into the parser.
+ */
+static ssize_t lunix_feed_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct lunix_feed_state_struct *state = iocb->ki_filp->private_data;
+	ktime_t rx_time = lunix_latency_now();
+	ssize_t ret = 0;
+	size_t len;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	/* Writers sharing a file share its parser, one at a time */
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!mutex_trylock(&state->lock))
+			return -EAGAIN;
+	} else if (mutex_lock_interruptible(&state->lock)) {
+		return -ERESTARTSYS;
+	}
+
+	while (iov_iter_count(from)) {
+		len = copy_from_iter(state->buf, sizeof(state->buf), from);
+		if (!len) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+
+		lunix_stat_add(LUNIX_STAT_FEED_BYTES, len);
+		lunix_tap_raw(state->buf, len);
+
+		state->proto.rx_time = rx_time;
+		lunix_protocol_received_buf(&state->proto, state->buf, len);
+		ret += len;
+	}
+
+	mutex_unlock(&state->lock);
+
+	/* A write is a batch, as a receive_buf() call is for the line discipline */
+	lunix_sensor_wake_flush();
+	return ret;
+}
+
+static const struct file_operations lunix_feed_fops = {
+	.owner        = THIS_MODULE,
+	.open         = lunix_feed_open,
+	.release      = lunix_feed_release,
+	.write_iter   = lunix_feed_write_iter,
+	.splice_write = iter_file_splice_write,
+};
+
+static struct miscdevice lunix_feed_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = LUNIX_FEED_NAME,
+	.fops  = &lunix_feed_fops,
+	.mode  = 0200,
+};
+
+int lunix_feed_init(void)
+{
+	int ret;
+
+	debug("initializing feed device\n");
+	if ((ret = misc_register(&lunix_feed_misc)) < 0)
+		printk(KERN_ERR "%s: Error registering feed device, ret = %d.\n", __FILE__, ret);
+	return ret;
+}
+
+void lunix_feed_destroy(void)
+{
+	debug("removing feed device\n");
+	misc_deregister(&lunix_feed_misc);
+}
@@ -0,0 +1,46 @@
+/*
+ * lunix-feed.h
+ *
+ * Definition file for the
+ * Lunix:TNG feed device
+ */
+
+#ifndef _LUNIX_FEED_H
+#define _LUNIX_FEED_H
+
+/*
+ * Device node taking XMesh data written to it, as if received by
+ * the line discipline, but without a TTY in between
+ */
+#define LUNIX_FEED_NAME "lunix-feed"
+
+#ifdef __KERNEL__
+
+#include <linux/mutex.h>
+
+#include "lunix-protocol.h"
+
+/*
+ * Bytes copied in and parsed at a time
+ */
+#define LUNIX_FEED_CHUNK 4096
+
+/*
+ * Private state for an open feed device: every feeder
+ * has its own parser, as if it had its own serial line.
+ */
+struct lunix_feed_state_struct {
+	struct mutex lock;
+	struct lunix_protocol_state_struct proto;
+	unsigned char buf[LUNIX_FEED_CHUNK];
+};
+
+/*
+ * Function prototypes
+ */
+int lunix_feed_init(void);
+void lunix_feed_destroy(void);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LUNIX_FEED_H */
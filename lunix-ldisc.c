@@ -10,6 +10,13 @@
 #include <linux/serio.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
 
 #include <asm/atomic.h>
 #include <asm/uaccess.h>
@@ -17,30 +24,213 @@
 #include "lunix.h"
 #include "lunix-ldisc.h"
 #include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+#include "lunix-trace.h"
+#include "lunix-xmesh.h"
 
 /*
- * This line discipline can only be associated
- * with a single TTY at any time.
+ * This line discipline can be associated with up to
+ * lunix_ldisc_max_ttys TTYs at any time, e.g. one
+ * per base station or serial link.
  */
+static unsigned int lunix_ldisc_max_ttys = LUNIX_LDISC_MAX_TTYS;
+module_param(lunix_ldisc_max_ttys, uint, 0444);
+MODULE_PARM_DESC(lunix_ldisc_max_ttys, "Maximum number of TTYs to attach the line discipline to");
+
 static atomic_t lunix_disc_available;
 
+/*
+ * Optionally, received data are only queued by the line discipline
+ * and parsed by a dedicated kernel thread, which can be pinned to a
+ * set of CPUs. Every TTY gets its own FIFO and thread. A FIFO has a
+ * single producer (receive_buf, which is never re-entered) and a
+ * single consumer (the thread), so it needs no locking.
+ */
+#define LUNIX_PARSER_FIFO_SIZE 65536
+#define LUNIX_PARSER_CHUNK     512
+
+static bool lunix_parser_thread;
+module_param(lunix_parser_thread, bool, 0444);
+MODULE_PARM_DESC(lunix_parser_thread, "Parse received data in a dedicated kernel thread");
+
+static char *lunix_parser_cpus;
+module_param(lunix_parser_cpus, charp, 0444);
+MODULE_PARM_DESC(lunix_parser_cpus, "CPU list to run the parser threads on (default: any)");
+
+/*
+ * Per-TTY state, in tty->disc_data: every TTY carries
+ * a stream of its own, with a protocol parser of its own.
+ */
+struct lunix_ldisc_struct {
+	struct tty_struct *tty;
+	struct list_head list;          /* In lunix_ldisc_list */
+	struct lunix_protocol_state_struct proto;
+
+	/* Threaded mode only */
+	DECLARE_KFIFO_PTR(fifo, unsigned char);
+	wait_queue_head_t wq;
+	struct task_struct *task;
+	atomic64_t rx_time;     /* When the oldest data in the FIFO were received */
+};
+
+/*
+ * The TTYs the line discipline is set on, for sending commands
+ * down to the nodes. The mutex also keeps a TTY from being
+ * closed while a command is being written to it.
+ */
+static LIST_HEAD(lunix_ldisc_list);
+static DEFINE_MUTEX(lunix_ldisc_mutex);
+
+/* The sequence number of the next command sent */
+static atomic_t lunix_ldisc_xcmd_seqno;
+
+/*
+ * Passes received data to the protocol processing code, which handles
+ * any necessary sensor updates, accounting for the parser's cost.
+ */
+static void lunix_ldisc_parse(struct lunix_ldisc_struct *ld, const unsigned char *buf,
+                              int count, ktime_t rx_time)
+{
+	cycles_t start = 0;
+
+	if (lunix_latency_enabled())
+		start = get_cycles();
+
+	ld->proto.rx_time = rx_time;
+	lunix_protocol_received_buf(&ld->proto, buf, count);
+
+	if (start && count)
+		lunix_latency_record(LUNIX_LAT_PARSER_CPB, div_u64(get_cycles() - start, count));
+}
+
+/*
+ * The parser thread of a TTY: drains the FIFO filled by
+ * lunix_ldisc_receive_buf() and passes its contents
+ * to the protocol processing code.
+ */
+static int lunix_ldisc_parser_thread(void *data)
+{
+	struct lunix_ldisc_struct *ld = data;
+	unsigned char buf[LUNIX_PARSER_CHUNK];
+	unsigned int len;
+	ktime_t rx_time;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(ld->wq, !kfifo_is_empty(&ld->fifo) || kthread_should_stop());
+
+		rx_time = atomic64_read(&ld->rx_time);
+		while ((len = kfifo_out(&ld->fifo, buf, sizeof(buf))) > 0)
+			lunix_ldisc_parse(ld, buf, len, rx_time);
+
+		/* The FIFO is drained, this is the end of a batch */
+		lunix_sensor_wake_flush();
+	}
+
+	return 0;
+}
+
+/*
+ * Starts the parser thread of a TTY, on the CPUs
+ * in lunix_parser_cpus if given.
+ */
+static int lunix_ldisc_parser_start(struct lunix_ldisc_struct *ld, struct tty_struct *tty)
+{
+	struct task_struct *task;
+	cpumask_var_t mask;
+	int ret;
+
+	if ((ret = kfifo_alloc(&ld->fifo, LUNIX_PARSER_FIFO_SIZE, GFP_KERNEL)) < 0)
+		goto out;
+	init_waitqueue_head(&ld->wq);
+
+	task = kthread_create(lunix_ldisc_parser_thread, ld, "lunix-parser/%s", tty->name);
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		goto out_with_fifo;
+	}
+
+	if (lunix_parser_cpus) {
+		if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+			ret = -ENOMEM;
+			goto out_with_task;
+		}
+		ret = cpulist_parse(lunix_parser_cpus, mask);
+		if (!ret)
+			ret = set_cpus_allowed_ptr(task, mask);
+		free_cpumask_var(mask);
+		if (ret < 0) {
+			printk(KERN_ERR "lunix: invalid parser CPU list \"%s\"\n", lunix_parser_cpus);
+			goto out_with_task;
+		}
+	}
+
+	ld->task = task;
+	wake_up_process(task);
+	return 0;
+
+out_with_task:
+	kthread_stop(task);
+out_with_fifo:
+	kfifo_free(&ld->fifo);
+out:
+	return ret;
+}
+
+static void lunix_ldisc_parser_stop(struct lunix_ldisc_struct *ld)
+{
+	kthread_stop(ld->task);
+	kfifo_free(&ld->fifo);
+	ld->task = NULL;
+}
+
 /*
  * This function runs when the userspace helper
  * sets the Lunix:TNG line discipline on a TTY.
  */
 static int lunix_ldisc_open(struct tty_struct *tty)
 {
+	struct lunix_ldisc_struct *ld;
+	int ret;
+
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
 
-	/* Can only be associated with a single TTY */
+	/* Can only be associated with so many TTYs */
 	if ( !atomic_add_unless(&lunix_disc_available, -1, 0))
 		return -EBUSY;
 
+	ret = -ENOMEM;
+	ld = kzalloc(sizeof(*ld), GFP_KERNEL);
+	if (!ld)
+		goto out;
+
+	/* Every TTY starts mid-stream */
+	lunix_protocol_init(&ld->proto);
+
+	if (lunix_parser_thread && (ret = lunix_ldisc_parser_start(ld, tty)) < 0) {
+		printk(KERN_ERR "%s: Error starting parser thread, ret = %d.\n",
+		                __FILE__, ret);
+		goto out_with_ld;
+	}
+
+	ld->tty = tty;
+	tty->disc_data = ld;
 	tty->receive_room = 65536; /* No flow control, FIXME */
 
+	mutex_lock(&lunix_ldisc_mutex);
+	list_add_tail(&ld->list, &lunix_ldisc_list);
+	mutex_unlock(&lunix_ldisc_mutex);
+	lunix_sensor_feed_attach();
+
 	debug("lunix ldisc associated with TTY %s\n", tty->name);
 	return 0;
+
+out_with_ld:
+	kfree(ld);
+out:
+	atomic_inc(&lunix_disc_available);
+	return ret;
 }
 
 /*
@@ -49,36 +239,147 @@ static int lunix_ldisc_open(struct tty_struct *tty)
  */
 static void lunix_ldisc_close(struct tty_struct *tty)
 {
+	struct lunix_ldisc_struct *ld = tty->disc_data;
+
+	mutex_lock(&lunix_ldisc_mutex);
+	list_del(&ld->list);
+	mutex_unlock(&lunix_ldisc_mutex);
+
+	/* receive_buf() is no longer running, nor will it be */
+	if (ld->task)
+		lunix_ldisc_parser_stop(ld);
+	tty->disc_data = NULL;
+	kfree(ld);
+
 	atomic_inc(&lunix_disc_available);
-	/* FIXME */
-	/* Shouldn't we wake up all sleepers in all sensors here? */
+
+	/* If this was the last feed, readers waiting for data get told */
+	lunix_sensor_feed_detach();
 	debug("lunix ldisc being closed\n");
 }
 
 /*
  * lunix_ldisc_receive_buf() is called by the TTY layer when data have been
  * received by the low level TTY driver and are ready for us. This function
- * will not be re-entered while running.
+ * will not be re-entered while running, for the same TTY; for different
+ * TTYs, it may run concurrently.
  */
 // static void lunix_ldisc_receive_buf(struct tty_struct *tty,
 //                                     const unsigned char *cp,
 //                                     const unsigned char *fp, size_t count)
 static void lunix_ldisc_receive_buf(struct tty_struct *tty, const unsigned char *cp, const char *fp, int count)
 {
-#if LUNIX_DEBUG
-	int i;
+	struct lunix_ldisc_struct *ld = tty->disc_data;
+
+	trace_lunix_ldisc_receive(cp, count);
+
+	lunix_stat_inc(LUNIX_STAT_RX_BATCHES);
+	lunix_stat_add(LUNIX_STAT_RX_BYTES, count);
+	lunix_tap_raw(cp, count);
 
-	debug("called, %lu characters have been received. Data at *cp: { ", (size_t)count);
-	for (i = 0; i < count; i++)
-		printk(KERN_CONT "0x%02x%s", cp[i], (i == count - 1) ? "" : ", ");
-	printk(KERN_CONT " }\n");
-#endif
+	/*
+	 * In threaded mode, just queue the data for the parser thread.
+	 * Whatever does not fit is dropped, the parser will resync.
+	 */
+	if (ld->task) {
+		unsigned int queued;
+
+		if (lunix_latency_enabled() && kfifo_is_empty(&ld->fifo))
+			atomic64_set(&ld->rx_time, ktime_get());
+
+		queued = kfifo_in(&ld->fifo, cp, count);
+
+		if (queued < count) {
+			lunix_stat_add(LUNIX_STAT_FIFO_DROPS, count - queued);
+			printk_ratelimited(KERN_WARNING "lunix: parser FIFO of %s full, dropped %u bytes\n",
+			                   tty->name, count - queued);
+		}
+		wake_up(&ld->wq);
+		return;
+	}
 
 	/*
 	 * Pass incoming characters to protocol processing code,
 	 * which handles any necessary sensor updates.
 	 */
-	lunix_protocol_received_buf(&lunix_protocol_state, cp, count);
+	lunix_ldisc_parse(ld, cp, count, lunix_latency_now());
+
+	/*
+	 * Wake up the readers of all sensors updated by this batch,
+	 * once each.
+	 */
+	lunix_sensor_wake_flush();
+}
+
+/*
+ * Sends an XCommand packet to a node, through every TTY the line
+ * discipline is set on: the node is behind one of the base stations,
+ * and the others drop the packet. The packet is only queued on a TTY
+ * with room for all of it, so that a partial packet never confuses
+ * the base station.
+ *
+ * Returns 0 if it went out on at least one TTY, -ENODEV if there
+ * are none, or -EAGAIN if none had room for it.
+ */
+int lunix_ldisc_xcommand(int node, u16 cmd, u32 arg)
+{
+	unsigned char wire[XMESH_WIRE_LEN(XMESH_XCOMMAND_PL)];
+	struct lunix_ldisc_struct *ld;
+	int len, sent = 0, ret = -ENODEV;
+
+	len = xmesh_xcommand_packet(wire, node, atomic_inc_return(&lunix_ldisc_xcmd_seqno),
+	                            cmd, arg);
+
+	mutex_lock(&lunix_ldisc_mutex);
+	list_for_each_entry(ld, &lunix_ldisc_list, list) {
+		ret = -EAGAIN;
+		if (tty_write_room(ld->tty) < len)
+			continue;
+		if (ld->tty->ops->write(ld->tty, wire, len) == len)
+			sent++;
+	}
+	mutex_unlock(&lunix_ldisc_mutex);
+
+	if (!sent)
+		return ret;
+
+	lunix_stat_inc(LUNIX_STAT_TX_COMMANDS);
+	debug("sent command 0x%x (%u) to node %d on %d TTYs\n", cmd, arg, node, sent);
+	return 0;
+}
+
+/*
+ * Sets or returns the role of a TTY, primary or standby. The
+ * termios ioctls are handled as by other line disciplines, so
+ * that the line can still be configured while it is attached.
+ */
+static int lunix_ldisc_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+{
+	struct lunix_ldisc_struct *ld = tty->disc_data;
+	int __user *uarg = (int __user *)arg;
+	int role;
+
+	switch (cmd) {
+	case LUNIX_LDISC_IOC_SET_ROLE:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if (get_user(role, uarg))
+			return -EFAULT;
+		if (role != LUNIX_LDISC_PRIMARY && role != LUNIX_LDISC_STANDBY)
+			return -EINVAL;
+
+		/* Read by the parser of the TTY, wherever it runs */
+		WRITE_ONCE(ld->proto.standby, role == LUNIX_LDISC_STANDBY);
+		debug("TTY %s is now a %s feed\n", tty->name, role ? "standby" : "primary");
+		return 0;
+
+	case LUNIX_LDISC_IOC_GET_ROLE:
+		role = READ_ONCE(ld->proto.standby) ? LUNIX_LDISC_STANDBY : LUNIX_LDISC_PRIMARY;
+		return put_user(role, uarg);
+
+	default:
+		return tty_mode_ioctl(tty, cmd, arg);
+	}
 }
 
 /*
@@ -112,6 +413,7 @@ static struct tty_ldisc_ops lunix_ldisc_ops = {
 	.close       = lunix_ldisc_close,
 	.read        = lunix_ldisc_read,
 	.write       = lunix_ldisc_write,
+	.ioctl       = lunix_ldisc_ioctl,
 	.receive_buf = lunix_ldisc_receive_buf
 };
 
@@ -120,7 +422,8 @@ int lunix_ldisc_init(void)
 	int ret;
 
 	debug("initializing lunix ldisc\n");
-	atomic_set(&lunix_disc_available, 1);
+	atomic_set(&lunix_disc_available, lunix_ldisc_max_ttys);
+
 	ret = tty_register_ldisc(&lunix_ldisc_ops);
 	if (ret)
 		printk(KERN_ERR "%s: Error registering line discipline, ret = %d.\n",
@@ -1,5 +1,5 @@
 /*
- * lunix-chrdev.h
+ * lunix-ldisc.h
  *
  * Definition file for the
  * Lunix:TNG TTY line discipline
@@ -9,6 +9,24 @@
 #define _LUNIX_LDISC_H
 
 /* Compile-time parameters */
+#define LUNIX_LDISC_MAX_TTYS 4   /* Default for the lunix_ldisc_max_ttys parameter */
+
+#include <linux/ioctl.h>
+
+/*
+ * Roles of a TTY the line discipline is set on. A standby TTY is
+ * parsed all the same, but its packets are only published while
+ * no primary feed has delivered any for lunix_failover_gap_ms.
+ */
+#define LUNIX_LDISC_PRIMARY 0
+#define LUNIX_LDISC_STANDBY 1
+
+/*
+ * ioctls on the TTY, once the line discipline is set
+ */
+#define LUNIX_LDISC_IOC_MAGIC    'L'
+#define LUNIX_LDISC_IOC_SET_ROLE _IOW(LUNIX_LDISC_IOC_MAGIC, 0x60, int)
+#define LUNIX_LDISC_IOC_GET_ROLE _IOR(LUNIX_LDISC_IOC_MAGIC, 0x61, int)
 
 #ifdef __KERNEL__ 
 
@@ -17,6 +35,7 @@
  */
 int lunix_ldisc_init(void);
 void lunix_ldisc_destroy(void);
+int lunix_ldisc_xcommand(int node, u16 cmd, u32 arg);
 
 #endif /* __KERNEL__ */
 
@@ -10,15 +10,24 @@
 
 #include "lunix.h"
 #include "lunix-chrdev.h"
+#include "lunix-feed.h"
 #include "lunix-ldisc.h"
 #include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+#include "lunix-tcp.h"
+
+#define CREATE_TRACE_POINTS
+#include "lunix-trace.h"
 
 /*
  * Global state for Lunix:TNG sensors
  */
 int lunix_sensor_cnt = LUNIX_SENSOR_CNT;
 struct lunix_sensor_struct *lunix_sensors;
-struct lunix_protocol_state_struct lunix_protocol_state;
+
+/* For the self-test module, lunix-selftest.ko */
+EXPORT_SYMBOL_GPL(lunix_sensor_cnt);
 
 /*
  * Module init and cleanup functions
@@ -38,7 +47,6 @@ static int __init lunix_module_init(void)
 		printk(KERN_ERR "Failed to allocate memory for Lunix sensors\n");
 		goto out;
 	}
-	lunix_protocol_init(&lunix_protocol_state);
 
 	/*
 	 * Initialize all sensors. On exit, si_done is the index of the last
@@ -53,11 +61,29 @@ static int __init lunix_module_init(void)
 		}
 	}
 
+	/*
+	 * Initialize the hot path statistics
+	 */
+	if ((ret = lunix_stats_init()) < 0)
+		goto out_with_sensors;
+
+	/*
+	 * Initialize the coalescing of reader wakeups
+	 */
+	if ((ret = lunix_sensor_wake_init()) < 0)
+		goto out_with_stats;
+
+	/*
+	 * Initialize the traffic taps, before anything can feed them
+	 */
+	if ((ret = lunix_tap_init()) < 0)
+		goto out_with_wake;
+
 	/*
 	 * Initialize the Lunix line discipline
 	 */
 	if ((ret = lunix_ldisc_init()) < 0)
-		goto out_with_sensors;
+		goto out_with_tap;
 
 	/*
 	 * Initialize the Lunix character device
@@ -65,16 +91,48 @@ static int __init lunix_module_init(void)
 	if ((ret = lunix_chrdev_init()) < 0)
 		goto out_with_ldisc;
 
+	/*
+	 * Initialize the feed device, bypassing the line discipline
+	 */
+	if ((ret = lunix_feed_init()) < 0)
+		goto out_with_chrdev;
+
+	/*
+	 * Start ingesting from TCP, if an endpoint was given
+	 */
+	if ((ret = lunix_tcp_init()) < 0)
+		goto out_with_feed;
+
 	return 0;
 
 	/*
 	 * Something's gone wrong, undo everything
 	 * we've done up to this point
 	 */
+out_with_feed:
+	debug("at out_with_feed\n");
+	lunix_feed_destroy();
+
+out_with_chrdev:
+	debug("at out_with_chrdev\n");
+	lunix_chrdev_destroy();
+
 out_with_ldisc:
 	debug("at out_with_ldisc\n");
 	lunix_ldisc_destroy();
 
+out_with_tap:
+	debug("at out_with_tap\n");
+	lunix_tap_destroy();
+
+out_with_wake:
+	debug("at out_with_wake\n");
+	lunix_sensor_wake_destroy();
+
+out_with_stats:
+	debug("at out_with_stats\n");
+	lunix_stats_destroy();
+
 out_with_sensors:
 	debug("at out_with_sensors\n");
 	for (; si_done >= 0; si_done--)
@@ -90,9 +148,14 @@ static void __exit lunix_module_cleanup(void)
 {
 	int si_done;
 	
-	debug("entering, destroying chrdev and ldisc\n");
+	debug("entering, destroying TCP ingest, feed, chrdev and ldisc\n");
+	lunix_tcp_destroy();
+	lunix_feed_destroy();
 	lunix_chrdev_destroy();
 	lunix_ldisc_destroy();
+	lunix_tap_destroy();
+	lunix_sensor_wake_destroy();
+	lunix_stats_destroy();
 	
 	debug("destroying sensor buffers\n");
 	for (si_done = lunix_sensor_cnt - 1; si_done >= 0; si_done--)
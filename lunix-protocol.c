@@ -11,10 +11,38 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/crc-itu-t.h>
 #include <asm/byteorder.h>
 
 #include "lunix.h"
 #include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+#include "lunix-trace.h"
+
+static bool lunix_crc_check = false;
+module_param(lunix_crc_check, bool, 0644);
+MODULE_PARM_DESC(lunix_crc_check, "Drop XMesh packets with a bad CRC (default: count them only)");
+
+static bool lunix_dedup = true;
+module_param(lunix_dedup, bool, 0644);
+MODULE_PARM_DESC(lunix_dedup, "Drop the copies of XMesh packets delivered more than once");
+
+/*
+ * Hot standby: the packets of standby feeds are only published once
+ * no primary feed has published any for lunix_failover_gap_ms. The
+ * standby parsers keep running meanwhile, so they are in sync when
+ * their turn comes; the copies of packets published by both sides
+ * around a switch are dropped as duplicates.
+ */
+static unsigned int lunix_failover_gap_ms = 500;
+module_param(lunix_failover_gap_ms, uint, 0644);
+MODULE_PARM_DESC(lunix_failover_gap_ms, "Publish from standby feeds after this long without "
+                 "packets from a primary one, in msecs (0: always)");
+
+static unsigned long lunix_primary_jiffies;     /* When a primary feed last published */
+static unsigned long lunix_failover_active;     /* Bit 0: the standby feeds are publishing */
 
 /*
  * Returns an unsigned 16-bit integer in native byte-order from 
@@ -46,6 +74,89 @@ static inline void lunix_protocol_show_packet(
 #endif
 }
 
+/*
+ * Checks the CRC of a complete XMesh packet. As in the TinyOS serial
+ * framing, it is a CRC-16/CCITT (polynomial 0x1021, initial value 0)
+ * over everything from the packet type to the end of the payload,
+ * and it is transmitted little-endian.
+ */
+static int lunix_protocol_crc_ok(struct lunix_protocol_state_struct *state)
+{
+	int len = PAYLOAD_OFFSET + state->packet[PAYLOAD_LENGTH_OFFSET] - PACKET_TYPE_OFFSET;
+
+	return crc_itu_t(0, &state->packet[PACKET_TYPE_OFFSET], len) ==
+	       uint16_from_packet(&state->packet[PACKET_TYPE_OFFSET + len]);
+}
+
+/*
+ * In a mesh, a packet may take alternative routes, and reach the base
+ * station more than once, with a different last hop and hop count, but
+ * the same origin, sequence number and measurements. Checks whether a
+ * packet is such a copy of one of the last few received from its node,
+ * and remembers it otherwise.
+ *
+ * The window is kept per node, not per parser, so that copies arriving
+ * through different TTYs are caught as well.
+ */
+static bool lunix_protocol_is_duplicate(struct lunix_sensor_struct *s, uint16_t seqno,
+                                        uint16_t batt, uint16_t temp, uint16_t light)
+{
+	uint64_t key = (uint64_t)seqno << 48 | (uint64_t)batt << 32 | (uint64_t)temp << 16 | light;
+	bool dup = false;
+	unsigned int i;
+
+	spin_lock(&s->lock);
+	for (i = 0; i < s->dedup_cnt; i++) {
+		if (s->dedup_key[i] == key) {
+			dup = true;
+			goto out;
+		}
+	}
+
+	s->dedup_key[s->dedup_next] = key;
+	s->dedup_next = (s->dedup_next + 1) % LUNIX_DEDUP_WINDOW;
+	if (s->dedup_cnt < LUNIX_DEDUP_WINDOW)
+		s->dedup_cnt++;
+out:
+	spin_unlock(&s->lock);
+	return dup;
+}
+
+/*
+ * Decides whether a sensor packet of a feed may be published: always
+ * for a primary feed, and for a standby feed only once the primary
+ * feeds have been silent for longer than the failover gap. Switching
+ * over, in either direction, is logged, counted and traced.
+ */
+static bool lunix_protocol_may_publish(struct lunix_protocol_state_struct *state)
+{
+	unsigned int gap_ms = READ_ONCE(lunix_failover_gap_ms);
+
+	if (!READ_ONCE(state->standby)) {
+		WRITE_ONCE(lunix_primary_jiffies, jiffies);
+		if (test_bit(0, &lunix_failover_active) &&
+		    test_and_clear_bit(0, &lunix_failover_active)) {
+			trace_lunix_failover(0);
+			printk(KERN_INFO "lunix: primary feed back, standby feeds held\n");
+		}
+		return true;
+	}
+
+	if (!gap_ms)
+		return true;
+	if (time_before(jiffies, READ_ONCE(lunix_primary_jiffies) + msecs_to_jiffies(gap_ms)))
+		return false;
+
+	if (!test_bit(0, &lunix_failover_active) &&
+	    !test_and_set_bit(0, &lunix_failover_active)) {
+		lunix_stat_inc(LUNIX_STAT_FAILOVERS);
+		trace_lunix_failover(1);
+		printk(KERN_WARNING "lunix: no packets from a primary feed for %u ms, "
+		       "standby feeds publishing\n", gap_ms);
+	}
+	return true;
+}
+
 /*
  * Receives a complete XMesh packet and updates the node structures if
  * the packet contains sensor information. The function ignores other
@@ -63,6 +174,8 @@ static void lunix_protocol_update_sensors(
 
 	if (0x0B == state->packet[PACKET_SIGNATURE_OFFSET])
 	{
+		lunix_stat_inc(LUNIX_STAT_SENSOR_FRAMES);
+
 		nodeid = uint16_from_packet(&state->packet[NODE_OFFSET]);
 		batt = uint16_from_packet(&state->packet[VREF_OFFSET]);
 		temp = uint16_from_packet(&state->packet[TEMPERATURE_OFFSET]);
@@ -73,11 +186,26 @@ static void lunix_protocol_update_sensors(
 		       "{ batt, temp, light } = { 0x%04x, 0x%04x, 0x%04x }\n",
 		       nodeid, batt, temp, light);
 
-		if (nodeid > 0 && nodeid <= lunix_sensor_cnt)
-			lunix_sensor_update(&lunix_sensors[nodeid - 1], batt, temp, light);
-		else
-			printk(KERN_WARNING "Node id %d is out of bounds [maximum %d sensors]\n",
-			                    nodeid, lunix_sensor_cnt);
+		if (nodeid > 0 && nodeid <= lunix_sensor_cnt) {
+			if (!lunix_protocol_may_publish(state)) {
+				lunix_stat_inc(LUNIX_STAT_STANDBY_HELD);
+				return;
+			}
+			if (lunix_dedup &&
+			    lunix_protocol_is_duplicate(&lunix_sensors[nodeid - 1],
+			                                uint16_from_packet(&state->packet[SEQNO_OFFSET]),
+			                                batt, temp, light)) {
+				lunix_stat_inc(LUNIX_STAT_DUPLICATES);
+				return;
+			}
+			lunix_sensor_update(&lunix_sensors[nodeid - 1], batt, temp, light,
+			                    state->frame_time);
+			lunix_latency_since(LUNIX_LAT_PUBLISH, state->complete_time, lunix_latency_now());
+		} else {
+			lunix_stat_inc(LUNIX_STAT_BAD_NODE);
+			printk_ratelimited(KERN_WARNING "Node id %d is out of bounds [maximum %d sensors]\n",
+			                   nodeid, lunix_sensor_cnt);
+		}
 	}
 }
 
@@ -114,8 +242,11 @@ void lunix_protocol_init(struct lunix_protocol_state_struct *state)
 {
 	state->pos = 0;
 	state->next_is_special = 0;
+	state->rx_time = state->frame_time = state->complete_time = 0;
+	state->standby = false;
 	set_state(state, SEEKING_START_BYTE, 1, 0);
 }
+EXPORT_SYMBOL_GPL(lunix_protocol_init);
 
 /*
  * Crucial function for parsing the input packet according
@@ -145,6 +276,7 @@ static int lunix_protocol_parse_state(struct lunix_protocol_state_struct *state,
 #endif
 		/* Prevent buffer overflows */
 		if (state->pos == MAX_PACKET_LEN) {
+			lunix_stat_inc(LUNIX_STAT_OVERFLOWS);
 			printk(KERN_ERR "WARNING: state->pos == %d, MAX_PACKET_LEN is %d,"
 			       "packet buffer would overflow!\n", state->pos, MAX_PACKET_LEN);
 			printk(KERN_ERR "How will I ever resync with the input stream?\n");
@@ -203,54 +335,86 @@ int lunix_protocol_received_buf(struct lunix_protocol_state_struct *state,
                                 const unsigned char *buf, int length)
 {
 	int i;
+	int crc_ok;
 	int payload_length;
 
 	i = 0;
 
-	if (state->state == SEEKING_START_BYTE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
-			set_state(state, SEEKING_PACKET_TYPE, 1, 0);
+	/*
+	 * A single buffer may carry several packets, or the tail of
+	 * one and the head of the next: keep walking the state machine
+	 * until every byte has been consumed.
+	 */
+	while (i < length) {
+		if (state->state == SEEKING_START_BYTE)
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1) {
+				/* Skip line noise until a frame delimiter shows up */
+				if (state->packet[0] != 0x7E) {
+					state->pos = 0;
+					set_state(state, SEEKING_START_BYTE, 1, 0);
+					continue;
+				}
+				trace_lunix_frame_start(i - 1, length);
+				state->frame_time = state->rx_time;
+				set_state(state, SEEKING_PACKET_TYPE, 1, 0);
+			}
 
+		if (state->state == SEEKING_PACKET_TYPE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
+				set_state(state, SEEKING_DESTINATION_ADDRESS, 2, 0);
 
-	if (state->state == SEEKING_PACKET_TYPE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1)
-			set_state(state, SEEKING_DESTINATION_ADDRESS, 2, 0);
+		if (state->state == SEEKING_DESTINATION_ADDRESS) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_AM_TYPE, 1, 0);
 
-	if (state->state == SEEKING_DESTINATION_ADDRESS) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_AM_TYPE, 1, 0);
+		if (state->state == SEEKING_AM_TYPE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_AM_GROUP, 1, 0);
 
-	if (state->state == SEEKING_AM_TYPE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_AM_GROUP, 1, 0);
+		if (state->state == SEEKING_AM_GROUP) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_PAYLOAD_LENGTH, 1, 0);
 
-	if (state->state == SEEKING_AM_GROUP) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_PAYLOAD_LENGTH, 1, 0);
+		if (state->state == SEEKING_PAYLOAD_LENGTH) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1) {
+				payload_length = state->packet[state->pos - 1];
+				set_state(state, SEEKING_PAYLOAD, payload_length, 0);
+			}
 
-	if (state->state == SEEKING_PAYLOAD_LENGTH) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1) {
-			payload_length = state->packet[state->pos - 1];
-			set_state(state, SEEKING_PAYLOAD, payload_length, 0);
-		}
+		if (state->state == SEEKING_PAYLOAD) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_CRC, 2, 0);
 
-	if (state->state == SEEKING_PAYLOAD) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_CRC, 2, 0);
+		if (state->state == SEEKING_CRC) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
+				set_state(state, SEEKING_END_BYTE, 1, 0);
 
-	if (state->state == SEEKING_CRC) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 1) == 1)
-			set_state(state, SEEKING_END_BYTE, 1, 0);
+		if (state->state == SEEKING_END_BYTE) 
+			if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1) {
+				debug("A complete XMesh packet has been received, updating sensors\n");
 
-	if (state->state == SEEKING_END_BYTE) 
-		if (lunix_protocol_parse_state(state, buf, length, &i, 0) == 1) {
-			debug("A complete XMesh packet has been received, updating sensors\n");
+				state->complete_time = lunix_latency_now();
+				lunix_latency_since(LUNIX_LAT_PARSE, state->frame_time, state->complete_time);
 
-			lunix_protocol_update_sensors(state, lunix_sensors);
-			state->pos = 0;
-			state->next_is_special = 0;
-			set_state(state, SEEKING_START_BYTE, 1, 0);
-		}
+				crc_ok = lunix_protocol_crc_ok(state);
+				trace_lunix_frame_complete(state->packet[PACKET_SIGNATURE_OFFSET],
+				                           state->packet[PAYLOAD_LENGTH_OFFSET], crc_ok);
+				lunix_tap_frame(state->packet, state->pos, crc_ok);
+
+				lunix_stat_inc(LUNIX_STAT_FRAMES);
+				if (crc_ok) {
+					lunix_protocol_update_sensors(state, lunix_sensors);
+				} else {
+					lunix_stat_inc(LUNIX_STAT_CRC_ERRORS);
+					if (!lunix_crc_check)
+						lunix_protocol_update_sensors(state, lunix_sensors);
+				}
+				state->pos = 0;
+				state->next_is_special = 0;
+				set_state(state, SEEKING_START_BYTE, 1, 0);
+			}
+	}
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(lunix_protocol_received_buf);
@@ -15,8 +15,12 @@
  * Application/Protocol specific constants
  */
 #define MAX_PACKET_LEN 300
+#define PACKET_TYPE_OFFSET 1
 #define PACKET_SIGNATURE_OFFSET 4
+#define PAYLOAD_LENGTH_OFFSET 6
+#define PAYLOAD_OFFSET 7
 #define NODE_OFFSET 9
+#define SEQNO_OFFSET 11
 #define VREF_OFFSET 18
 #define TEMPERATURE_OFFSET 20
 #define LIGHT_OFFSET 22
@@ -47,6 +51,18 @@ struct lunix_protocol_state_struct
 	unsigned char next_is_special;  /* The next character to be received is a special character */
 	unsigned char payload_length;   /* The length of the payload of the received packet */
 	unsigned char packet[MAX_PACKET_LEN]; /* The XMesh packet being received */
+
+	/*
+	 * Latency accounting, while enabled: when the current batch of data
+	 * was received (set by the caller), when the batch holding the first
+	 * byte of the current packet was received, and when it completed.
+	 */
+	ktime_t rx_time;
+	ktime_t frame_time;
+	ktime_t complete_time;
+
+	/* Packets from a standby feed are held while a primary one is live */
+	bool standby;
 };
 
 /*
@@ -0,0 +1,230 @@
+/*
+ * lunix-replay.c
+ *
+ * Replays a capture file made by lunix-capture through a pty,
+ * or into a file, either at the original timing, scaled,
+ * or as fast as possible, for reproducible benchmarks.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#include "lunix-tap.h"
+#include "lunix-xmesh.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * Configuration, from the command line
+ */
+static double speed = 1.0;      /* 0 for as fast as possible */
+static int use_frames;
+
+static struct {
+	unsigned long long records, bytes;
+} stats;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(long long t)
+{
+	struct timespec ts = { .tv_sec = t / NSEC_PER_SEC, .tv_nsec = t % NSEC_PER_SEC };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Escapes a decoded frame back into its wire form: everything
+ * between the start and end bytes that is a special character.
+ */
+static size_t frame_to_wire(unsigned char *wire, const unsigned char *frame, size_t len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		if (i > 0 && i < len - 1 &&
+		    (frame[i] == XMESH_SYNC_BYTE || frame[i] == XMESH_ESCAPE_BYTE)) {
+			wire[n++] = XMESH_ESCAPE_BYTE;
+			wire[n++] = frame[i] ^ 0x20;
+		} else {
+			wire[n++] = frame[i];
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Plays a capture file once, starting at `start'.
+ * Returns 0, or -1 on errors.
+ */
+static int replay(FILE *f, const char *name, int fd, long long start)
+{
+	static unsigned char data[65536], wire[2 * 65536];
+	struct lunix_cap_header hdr;
+	struct lunix_cap_record cap;
+	long long t = 0;
+	size_t n;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, LUNIX_CAP_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, "%s: not a Lunix:TNG capture file\n", name);
+		return -1;
+	}
+
+	while (fread(&cap, sizeof(cap), 1, f) == 1) {
+		if (fread(data, 1, cap.len, f) != cap.len) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			return -1;
+		}
+		t += cap.delta_us * 1000LL;
+
+		/* Raw records are the bytes as received; frames need escaping again */
+		if (cap.type == LUNIX_TAP_RAW && !use_frames) {
+			memcpy(wire, data, cap.len);
+			n = cap.len;
+		} else if (cap.type == LUNIX_TAP_FRAME && use_frames) {
+			n = frame_to_wire(wire, data, cap.len);
+		} else {
+			continue;
+		}
+
+		if (speed > 0)
+			sleep_until(start + t / speed);
+		if (write_all(fd, wire, n) < 0) {
+			perror("write");
+			return -1;
+		}
+		stats.records++;
+		stats.bytes += n;
+	}
+
+	return 0;
+}
+
+/*
+ * Opens a new pty to replay into, printing the name of its slave side
+ */
+static int open_pty(void)
+{
+	struct termios tio;
+	int fd;
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	printf("%s\n", ptsname(fd));
+	fflush(stdout);
+	return fd;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] {-p | -o file} capture_file\n\n"
+	        "  -p             replay on a new pty, whose name is printed\n"
+	        "  -o file        replay into a file, - for stdout\n"
+	        "  -s speed       replay at this multiple of the original speed (default 1)\n"
+	        "  -m             replay as fast as possible\n"
+	        "  -F             replay the decoded frames, escaped again, instead of\n"
+	        "                 the raw bytes; for captures made with -f only\n"
+	        "  -l loops       play the capture this many times (default 1)\n"
+	        "  -d seconds     wait this long before starting, to attach the\n"
+	        "                 line discipline to the pty (default 0)\n",
+	        argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out_file = NULL, *name;
+	long long start;
+	int use_pty = 0, loops = 1, delay = 0, fd, opt, i, ret = 0;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "po:s:mFl:d:")) != -1) {
+		switch (opt) {
+		case 'p': use_pty = 1; break;
+		case 'o': out_file = optarg; break;
+		case 's': speed = atof(optarg); break;
+		case 'm': speed = 0; break;
+		case 'F': use_frames = 1; break;
+		case 'l': loops = atoi(optarg); break;
+		case 'd': delay = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (use_pty + !!out_file != 1 || optind != argc - 1 || speed < 0 || loops < 1)
+		usage(argv[0]);
+	name = argv[optind];
+
+	if (!(f = fopen(name, "rb"))) {
+		perror(name);
+		return 1;
+	}
+	if (use_pty)
+		fd = open_pty();
+	else
+		fd = strcmp(out_file, "-") ? open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+	if (fd < 0) {
+		if (out_file)
+			perror(out_file);
+		return 1;
+	}
+	if (delay)
+		sleep(delay);
+
+	start = now_ns();
+	for (i = 0; i < loops && !ret; i++) {
+		rewind(f);
+		ret = replay(f, name, fd, now_ns());
+	}
+
+	fprintf(stderr, "%llu records, %llu bytes in %.3f s\n", stats.records, stats.bytes,
+	        (now_ns() - start) / 1e9);
+
+	/* Closing the master hangs up the slave, give the last bytes time to get through */
+	if (use_pty)
+		sleep(1);
+	close(fd);
+	fclose(f);
+	return ret < 0;
+}
@@ -0,0 +1,541 @@
+/*
+ * lunix-selftest.c
+ *
+ * In-kernel self-test and benchmark module
+ * for Lunix:TNG
+ *
+ * Feeds synthetic XMesh packets to the protocol code at a fixed
+ * rate, as if they had come in over a serial line, while reader
+ * kthreads block on the character device nodes. Throughput, packet
+ * drops, and the latency of every stage are reported through
+ * /sys/kernel/debug/lunix/selftest, so that driver changes can be
+ * tested on UML or a VM under repeatable load, without a serial
+ * line or a base station.
+ *
+ *   insmod lunix.ko && insmod lunix-selftest.ko rate=2000 readers=16
+ *   cat /sys/kernel/debug/lunix/selftest/results
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/sched/signal.h>
+
+#include "lunix.h"
+#include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-xmesh.h"
+
+/*
+ * Parameters of the next run
+ */
+static unsigned int rate = 1000;
+module_param(rate, uint, 0644);
+MODULE_PARM_DESC(rate, "Packets per second, over all nodes");
+
+static unsigned int nodes = LUNIX_SENSOR_CNT;
+module_param(nodes, uint, 0644);
+MODULE_PARM_DESC(nodes, "Number of nodes sending packets, round-robin");
+
+static unsigned int readers = 4;
+module_param(readers, uint, 0644);
+MODULE_PARM_DESC(readers, "Number of reader kthreads, spread over nodes and measurements");
+
+static unsigned int chunk = 64;
+module_param(chunk, uint, 0644);
+MODULE_PARM_DESC(chunk, "Bytes passed to the protocol code per call");
+
+static unsigned int duration = 10;
+module_param(duration, uint, 0644);
+MODULE_PARM_DESC(duration, "Length of a run in seconds (0: until stopped)");
+
+static char *dev = "/dev/lunix";
+module_param(dev, charp, 0444);
+MODULE_PARM_DESC(dev, "Prefix of the device nodes, as created by mk-lunix-devs.sh");
+
+static bool autostart = true;
+module_param(autostart, bool, 0444);
+MODULE_PARM_DESC(autostart, "Start a run when the module is loaded");
+
+/*
+ * Packets are generated in batches of at most this many bytes,
+ * every LUNIX_SELFTEST_TICK_US when keeping up with the rate
+ */
+#define LUNIX_SELFTEST_BATCH    (64 * 1024)
+#define LUNIX_SELFTEST_TICK_US  1000
+
+static const char * const lunix_selftest_msr_names[N_LUNIX_MSR] = {
+	[BATT]  = "batt",
+	[TEMP]  = "temp",
+	[LIGHT] = "light",
+};
+
+struct lunix_selftest_reader {
+	struct task_struct *task;
+	char path[64];
+	unsigned long reads;
+	unsigned long bytes;
+	int error;
+};
+
+/*
+ * State of the current (or last) run. Counters and histograms of
+ * lunix.ko are snapshotted when it starts and when it stops, and
+ * reported as differences: traffic from a real line discipline
+ * during a run is counted too.
+ */
+static struct lunix_selftest_struct {
+	struct mutex lock;              /* Serializes starting and stopping runs */
+	bool running;
+	bool stopping;                  /* Readers are about to be sent a SIGKILL */
+	bool latency_was_enabled;
+
+	struct task_struct *generator;
+	struct lunix_selftest_reader *readers;
+	unsigned int nr_readers;
+	struct delayed_work stop_work;
+
+	/* Configuration and progress of the run */
+	unsigned int rate, nodes, chunk;
+	ktime_t start, end;
+	u64 packets, bytes;
+
+	struct lunix_protocol_state_struct protocol;
+
+	u64 stat_start[N_LUNIX_STAT];
+	u64 stat_end[N_LUNIX_STAT];
+	u64 lat_start[N_LUNIX_LAT][LUNIX_LAT_BUCKETS];
+	u64 lat_end[N_LUNIX_LAT][LUNIX_LAT_BUCKETS];
+	u64 lat_now[N_LUNIX_LAT][LUNIX_LAT_BUCKETS];    /* Scratch space for results */
+} lunix_selftest;
+
+static struct dentry *lunix_selftest_dir;
+
+static void lunix_selftest_snapshot(u64 *stat, u64 (*lat)[LUNIX_LAT_BUCKETS])
+{
+	int i;
+
+	for (i = 0; i < N_LUNIX_STAT; i++)
+		stat[i] = lunix_stat_read(i);
+	for (i = 0; i < N_LUNIX_LAT; i++)
+		lunix_latency_read(i, lat[i]);
+}
+
+/*
+ * Waits for kthread_stop(), so that threads which are done early
+ * do not exit under the feet of the code stopping them.
+ */
+static void lunix_selftest_park(void)
+{
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/*
+ * The generator: builds packets from nodes 1..nodes, round-robin,
+ * and feeds them to the protocol code in chunks, as the line
+ * discipline would, catching up with the rate on every tick.
+ */
+static int lunix_selftest_generator(void *arg)
+{
+	struct lunix_selftest_struct *st = arg;
+	uint16_t node, seqno;
+	size_t len, off, n;
+	u64 due, sent;
+	u8 *buf;
+
+	buf = kmalloc(LUNIX_SELFTEST_BATCH, GFP_KERNEL);
+	if (!buf)
+		goto out;
+
+	sent = 0;
+	while (!kthread_should_stop()) {
+		due = div_u64((u64)ktime_to_ns(ktime_sub(ktime_get(), st->start)) * st->rate,
+		              NSEC_PER_SEC);
+		if (sent >= due) {
+			usleep_range(LUNIX_SELFTEST_TICK_US, LUNIX_SELFTEST_TICK_US * 5 / 4);
+			continue;
+		}
+
+		for (len = 0; sent < due && len + XMESH_MAX_WIRE <= LUNIX_SELFTEST_BATCH; sent++) {
+			node = 1 + sent % st->nodes;
+			seqno = div_u64(sent, st->nodes);
+			len += xmesh_sensor_packet(buf + len, node, seqno,
+			                           sent * 7, sent * 13, sent * 31);
+		}
+
+		for (off = 0; off < len; off += n) {
+			n = min_t(size_t, st->chunk, len - off);
+			st->protocol.rx_time = lunix_latency_now();
+			lunix_protocol_received_buf(&st->protocol, buf + off, n);
+		}
+		lunix_sensor_wake_flush();
+
+		WRITE_ONCE(st->packets, sent);
+		WRITE_ONCE(st->bytes, st->bytes + len);
+		cond_resched();
+	}
+
+	kfree(buf);
+out:
+	lunix_selftest_park();
+	return 0;
+}
+
+/*
+ * A reader: reads from its device node through kernel_read(),
+ * i.e. lunix_chrdev_read_iter(), until it is sent a SIGKILL.
+ */
+static int lunix_selftest_reader(void *arg)
+{
+	struct lunix_selftest_reader *r = arg;
+	struct file *filp;
+	loff_t pos = 0;
+	char buf[64];
+	ssize_t n;
+
+	/*
+	 * Either the SIGKILL is sent after this, and interrupts the
+	 * read, or `stopping` is already visible below.
+	 */
+	allow_signal(SIGKILL);
+	smp_mb();
+
+	filp = filp_open(r->path, O_RDONLY, 0);
+	if (IS_ERR(filp)) {
+		r->error = PTR_ERR(filp);
+		goto out;
+	}
+
+	while (!READ_ONCE(lunix_selftest.stopping)) {
+		n = kernel_read(filp, buf, sizeof(buf), &pos);
+		if (n < 0) {
+			if (n != -ERESTARTSYS)
+				r->error = n;
+			break;
+		}
+		WRITE_ONCE(r->reads, r->reads + 1);
+		WRITE_ONCE(r->bytes, r->bytes + n);
+	}
+	filp_close(filp, NULL);
+	flush_signals(current);
+
+out:
+	lunix_selftest_park();
+	return 0;
+}
+
+/*
+ * Stops the generator and reader threads that were started
+ */
+static void lunix_selftest_stop_threads(struct lunix_selftest_struct *st)
+{
+	int i;
+
+	if (st->generator) {
+		kthread_stop(st->generator);
+		st->generator = NULL;
+	}
+
+	/* Readers blocked in the driver only return on a signal */
+	WRITE_ONCE(st->stopping, true);
+	smp_mb();
+	for (i = 0; i < st->nr_readers; i++) {
+		if (!st->readers[i].task)
+			continue;
+		send_sig(SIGKILL, st->readers[i].task, 1);
+		kthread_stop(st->readers[i].task);
+		st->readers[i].task = NULL;
+	}
+	st->stopping = false;
+}
+
+/*
+ * Stops the current run, if any, and takes the final snapshot.
+ * Must be called with lunix_selftest.lock held.
+ */
+static void lunix_selftest_stop(struct lunix_selftest_struct *st)
+{
+	if (!st->running)
+		return;
+
+	lunix_selftest_stop_threads(st);
+	lunix_sensor_feed_detach();
+
+	st->end = ktime_get();
+	lunix_selftest_snapshot(st->stat_end, st->lat_end);
+	if (!st->latency_was_enabled)
+		static_branch_disable(&lunix_latency_key);
+
+	st->running = false;
+	printk(KERN_INFO "lunix-selftest: run complete, %llu packets sent\n", st->packets);
+}
+
+/*
+ * Starts a new run with the current module parameters.
+ * Must be called with lunix_selftest.lock held.
+ */
+static int lunix_selftest_start(struct lunix_selftest_struct *st)
+{
+	struct lunix_selftest_reader *r;
+	int i, ret;
+
+	if (st->running)
+		return -EBUSY;
+	if (!rate || !nodes || nodes > lunix_sensor_cnt || !chunk)
+		return -EINVAL;
+
+	kfree(st->readers);
+	st->nr_readers = 0;
+	st->readers = kcalloc(readers, sizeof(*st->readers), GFP_KERNEL);
+	if (readers && !st->readers)
+		return -ENOMEM;
+
+	st->rate = rate;
+	st->nodes = nodes;
+	st->chunk = chunk;
+	st->nr_readers = readers;
+	st->packets = st->bytes = 0;
+	lunix_protocol_init(&st->protocol);
+
+	/* The histograms are needed for the wakeup latencies */
+	st->latency_was_enabled = static_key_enabled(&lunix_latency_key);
+	static_branch_enable(&lunix_latency_key);
+	lunix_selftest_snapshot(st->stat_start, st->lat_start);
+	st->start = ktime_get();
+
+	/* The generator is a feed, attached before any reader opens */
+	lunix_sensor_feed_attach();
+
+	/*
+	 * Spread the readers over all nodes first, then measurements.
+	 * Readers that fail to start are reported, but do not fail the run.
+	 */
+	for (i = 0; i < st->nr_readers; i++) {
+		r = &st->readers[i];
+		snprintf(r->path, sizeof(r->path), "%s%u-%s", dev, i % st->nodes,
+		         lunix_selftest_msr_names[(i / st->nodes) % N_LUNIX_MSR]);
+		r->task = kthread_run(lunix_selftest_reader, r, "lunix-st-rd/%d", i);
+		if (IS_ERR(r->task)) {
+			r->error = PTR_ERR(r->task);
+			r->task = NULL;
+		}
+	}
+
+	st->generator = kthread_run(lunix_selftest_generator, st, "lunix-st-gen");
+	if (IS_ERR(st->generator)) {
+		ret = PTR_ERR(st->generator);
+		st->generator = NULL;
+		goto out_with_readers;
+	}
+
+	st->running = true;
+	if (duration)
+		schedule_delayed_work(&st->stop_work, duration * HZ);
+
+	printk(KERN_INFO "lunix-selftest: started, %u packets/s from %u nodes, %u readers\n",
+	       st->rate, st->nodes, st->nr_readers);
+	return 0;
+
+out_with_readers:
+	lunix_selftest_stop_threads(st);
+	lunix_sensor_feed_detach();
+	st->start = 0;
+	if (!st->latency_was_enabled)
+		static_branch_disable(&lunix_latency_key);
+	return ret;
+}
+
+static void lunix_selftest_stop_work(struct work_struct *work)
+{
+	mutex_lock(&lunix_selftest.lock);
+	lunix_selftest_stop(&lunix_selftest);
+	mutex_unlock(&lunix_selftest.lock);
+}
+
+/*
+ * /sys/kernel/debug/lunix/selftest/results: the configuration and
+ * outcome of the current or last run. While running, figures are
+ * up to the moment they are read.
+ */
+static int lunix_selftest_results_show(struct seq_file *m, void *v)
+{
+	static const char * const lat_names[N_LUNIX_LAT] = {
+		[LUNIX_LAT_PARSE]      = "parse_ns",
+		[LUNIX_LAT_PUBLISH]    = "publish_ns",
+		[LUNIX_LAT_WAKE]       = "wake_ns",
+		[LUNIX_LAT_SCHED]      = "sched_ns",
+		[LUNIX_LAT_COPY]       = "copy_ns",
+		[LUNIX_LAT_E2E]        = "e2e_ns",
+		[LUNIX_LAT_PARSER_CPB] = "parser_cycles_per_byte",
+	};
+	struct lunix_selftest_struct *st = &lunix_selftest;
+	struct lunix_selftest_reader *r;
+	u64 stat[N_LUNIX_STAT], bucket[LUNIX_LAT_BUCKETS];
+	u64 reads = 0, read_bytes = 0, total, elapsed_ms, sensor_frames;
+	u64 (*lat_end)[LUNIX_LAT_BUCKETS];
+	int i, j;
+
+	mutex_lock(&st->lock);
+	if (!st->start) {
+		seq_puts(m, "state: idle\n");
+		goto out;
+	}
+
+	if (st->running) {
+		lunix_selftest_snapshot(stat, st->lat_now);
+		lat_end = st->lat_now;
+		elapsed_ms = ktime_ms_delta(ktime_get(), st->start);
+	} else {
+		memcpy(stat, st->stat_end, sizeof(stat));
+		lat_end = st->lat_end;
+		elapsed_ms = ktime_ms_delta(st->end, st->start);
+	}
+	for (i = 0; i < N_LUNIX_STAT; i++)
+		stat[i] -= st->stat_start[i];
+	elapsed_ms = max_t(u64, elapsed_ms, 1);
+
+	seq_printf(m, "state: %s\n", st->running ? "running" : "stopped");
+	seq_printf(m, "config: rate=%u nodes=%u readers=%u chunk=%u\n",
+	           st->rate, st->nodes, st->nr_readers, st->chunk);
+	seq_printf(m, "elapsed_ms: %llu\n", elapsed_ms);
+
+	/* Producer side */
+	sensor_frames = stat[LUNIX_STAT_SENSOR_FRAMES];
+	seq_printf(m, "packets_sent: %llu (%llu/s)\n", st->packets,
+	           div64_u64(st->packets * 1000, elapsed_ms));
+	seq_printf(m, "bytes_sent: %llu (%llu/s)\n", st->bytes,
+	           div64_u64(st->bytes * 1000, elapsed_ms));
+	seq_printf(m, "packets_parsed: %llu\n", sensor_frames);
+	seq_printf(m, "packets_dropped: %llu\n",
+	           st->packets > sensor_frames ? st->packets - sensor_frames : 0);
+	seq_printf(m, "crc_errors: %llu\n", stat[LUNIX_STAT_CRC_ERRORS]);
+	seq_printf(m, "overflows: %llu\n", stat[LUNIX_STAT_OVERFLOWS]);
+	seq_printf(m, "bad_node: %llu\n", stat[LUNIX_STAT_BAD_NODE]);
+	seq_printf(m, "sensor_updates: %llu\n", stat[LUNIX_STAT_UPDATES]);
+
+	/* Consumer side */
+	for (i = 0; i < st->nr_readers; i++) {
+		reads += READ_ONCE(st->readers[i].reads);
+		read_bytes += READ_ONCE(st->readers[i].bytes);
+	}
+	seq_printf(m, "reads: %llu (%llu/s)\n", reads, div64_u64(reads * 1000, elapsed_ms));
+	seq_printf(m, "read_bytes: %llu (%llu/s)\n", read_bytes,
+	           div64_u64(read_bytes * 1000, elapsed_ms));
+	seq_printf(m, "reader_wakeups: %llu\n", stat[LUNIX_STAT_READER_WAKEUPS]);
+	seq_printf(m, "reader_filtered: %llu\n", stat[LUNIX_STAT_READER_FILTERED]);
+
+	/* Per-stage cost, over this run only */
+	for (i = 0; i < N_LUNIX_LAT; i++) {
+		for (total = 0, j = 0; j < LUNIX_LAT_BUCKETS; j++) {
+			bucket[j] = lat_end[i][j] - st->lat_start[i][j];
+			total += bucket[j];
+		}
+		seq_printf(m, "%s: samples=%llu", lat_names[i], total);
+		if (total)
+			seq_printf(m, " p50<%llu p90<%llu p99<%llu p99.9<%llu",
+			           lunix_latency_percentile(bucket, total, 500),
+			           lunix_latency_percentile(bucket, total, 900),
+			           lunix_latency_percentile(bucket, total, 990),
+			           lunix_latency_percentile(bucket, total, 999));
+		seq_putc(m, '\n');
+	}
+
+	for (i = 0; i < st->nr_readers; i++) {
+		r = &st->readers[i];
+		seq_printf(m, "reader%d: %s reads=%lu bytes=%lu error=%d\n", i, r->path,
+		           READ_ONCE(r->reads), READ_ONCE(r->bytes), r->error);
+	}
+
+out:
+	mutex_unlock(&st->lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lunix_selftest_results);
+
+/*
+ * /sys/kernel/debug/lunix/selftest/run: reads 1 while a run is
+ * in progress. Write 1 to start a new run, 0 to stop the current one.
+ */
+static int lunix_selftest_run_get(void *data, u64 *val)
+{
+	*val = READ_ONCE(lunix_selftest.running);
+	return 0;
+}
+
+static int lunix_selftest_run_set(void *data, u64 val)
+{
+	int ret = 0;
+
+	/* The stop work takes the lock itself */
+	cancel_delayed_work_sync(&lunix_selftest.stop_work);
+
+	mutex_lock(&lunix_selftest.lock);
+	if (val)
+		ret = lunix_selftest_start(&lunix_selftest);
+	else
+		lunix_selftest_stop(&lunix_selftest);
+	mutex_unlock(&lunix_selftest.lock);
+
+	return ret;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(lunix_selftest_run_fops, lunix_selftest_run_get,
+                         lunix_selftest_run_set, "%llu\n");
+
+static int __init lunix_selftest_init(void)
+{
+	int ret = 0;
+
+	mutex_init(&lunix_selftest.lock);
+	INIT_DELAYED_WORK(&lunix_selftest.stop_work, lunix_selftest_stop_work);
+
+	lunix_selftest_dir = debugfs_create_dir("selftest", lunix_debugfs_dir);
+	debugfs_create_file("results", 0444, lunix_selftest_dir, NULL,
+	                    &lunix_selftest_results_fops);
+	debugfs_create_file_unsafe("run", 0644, lunix_selftest_dir, NULL,
+	                           &lunix_selftest_run_fops);
+
+	if (autostart) {
+		mutex_lock(&lunix_selftest.lock);
+		ret = lunix_selftest_start(&lunix_selftest);
+		mutex_unlock(&lunix_selftest.lock);
+	}
+
+	if (ret < 0)
+		debugfs_remove_recursive(lunix_selftest_dir);
+	return ret;
+}
+
+static void __exit lunix_selftest_cleanup(void)
+{
+	debugfs_remove_recursive(lunix_selftest_dir);
+	cancel_delayed_work_sync(&lunix_selftest.stop_work);
+
+	mutex_lock(&lunix_selftest.lock);
+	lunix_selftest_stop(&lunix_selftest);
+	mutex_unlock(&lunix_selftest.lock);
+
+	kfree(lunix_selftest.readers);
+}
+
+MODULE_AUTHOR("Peter Jacob Floratos");
+MODULE_DESCRIPTION("Self-test and benchmark for Lunix:TNG");
+MODULE_LICENSE("GPL");
+
+module_init(lunix_selftest_init);
+module_exit(lunix_selftest_cleanup);
@@ -19,8 +19,75 @@
 #include <linux/mmzone.h>
 #include <linux/vmalloc.h>
 #include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/bitmap.h>
+#include <linux/workqueue.h>
 
 #include "lunix.h"
+#include "lunix-agg.h"
+#include "lunix-chrdev.h"
+#include "lunix-sketch.h"
+#include "lunix-stats.h"
+#include "lunix-trace.h"
+
+/*
+ * Sensors updated since the last time their sleepers were woken up.
+ * Wakeups are coalesced, so that each wait queue is woken up at most
+ * once per batch of data received, however many packets it carried.
+ */
+static unsigned long *lunix_sensors_pending;
+
+/*
+ * If non-zero, pending wakeups are further delayed by up to
+ * this many microseconds, to coalesce them across batches.
+ */
+static unsigned int lunix_wake_window_us;
+module_param(lunix_wake_window_us, uint, 0644);
+MODULE_PARM_DESC(lunix_wake_window_us, "Time window to coalesce reader wakeups over, in usecs (0: per batch)");
+
+/*
+ * Measurements published only when their value changes: an update
+ * with the same value as before neither advances their sequence
+ * number nor wakes up their readers. Battery voltage, in particular,
+ * hardly ever changes. Every lunix_heartbeat_s seconds, an unchanged
+ * value is published anyway, so that readers can tell a quiet
+ * measurement from a dead node.
+ */
+static unsigned int lunix_publish_on_change;
+module_param(lunix_publish_on_change, uint, 0644);
+MODULE_PARM_DESC(lunix_publish_on_change, "Measurements to publish on change only, "
+                 "as a mask (1: battery, 2: temperature, 4: light; default: none)");
+
+static unsigned int lunix_heartbeat_s = 60;
+module_param(lunix_heartbeat_s, uint, 0644);
+MODULE_PARM_DESC(lunix_heartbeat_s, "Publish unchanged measurements at least this often, "
+                 "in seconds (0: never)");
+
+/*
+ * Nodes silent for longer than lunix_stale_timeout_s seconds are
+ * marked stale, and their readers are told. The check runs once a
+ * second, off a deferrable timer, while any node is live: it never
+ * wakes up an idle CPU on its own, and does not run at all when
+ * every node is silent.
+ */
+static unsigned int lunix_stale_timeout_s;
+module_param(lunix_stale_timeout_s, uint, 0644);
+MODULE_PARM_DESC(lunix_stale_timeout_s, "Mark nodes stale after this many seconds of silence "
+                 "(0: never)");
+
+#define LUNIX_STALE_CHECK_PERIOD HZ
+
+/*
+ * The number of feeds attached, under lunix_feed_lock
+ */
+enum lunix_feed_enum lunix_sensors_feed_state;
+uint32_t lunix_sensors_feed_downs;
+static unsigned int lunix_feed_cnt;
+static spinlock_t lunix_feed_lock;
+
+static struct hrtimer lunix_wake_timer;
+static unsigned long lunix_wake_timer_armed;
+static struct delayed_work lunix_stale_work;
 
 /*
  * Initialization and destruction of sensor structures
@@ -40,8 +107,19 @@ int lunix_sensor_init(struct lunix_sensor_struct *s)
 	/*
 	 * Allocate one page per measurement buffer
 	 */
-	for (i = 0; i < N_LUNIX_MSR; i++)
+	s->rx_time = s->publish_time = s->wake_time = 0;
+	s->dedup_cnt = s->dedup_next = 0;
+	s->last_seen = jiffies;
+	s->node_state = LUNIX_NODE_UNSEEN;
+	s->stale_cnt = 0;
+	s->agg = NULL;
+	s->sketch = NULL;
+	for (i = 0; i < N_LUNIX_MSR; i++) {
 		s->msr_data[i] = NULL;
+		s->msr_seq[i] = 0;
+		s->msr_cnt[i] = 0;
+		s->msr_sum[i] = 0;
+	}
 
 	for (i = 0; i < N_LUNIX_MSR; i++) {
 		p = get_zeroed_page(GFP_KERNEL);
@@ -53,7 +131,9 @@ int lunix_sensor_init(struct lunix_sensor_struct *s)
 		s->msr_data[i]->magic = LUNIX_MSR_MAGIC;
 	}
 
-	ret = 0;
+	if ((ret = lunix_agg_init(s)) < 0)
+		goto out;
+	ret = lunix_sketch_init(s);
 out:
 	return ret;
 }
@@ -66,28 +146,264 @@ void lunix_sensor_destroy(struct lunix_sensor_struct *s)
 		if (s->msr_data[i])
 			free_page((unsigned long)s->msr_data[i]);
 	}
+	lunix_agg_destroy(s);
+	lunix_sketch_destroy(s);
+}
+
+/*
+ * Whether a new value of a measurement can go unpublished: it is to
+ * be published on change only, it has not changed, and the last value
+ * published is not older than the heartbeat. Called with the lock held.
+ */
+static bool lunix_sensor_unchanged(struct lunix_sensor_struct *s, int i, uint16_t value,
+                                   unsigned int on_change, unsigned long heartbeat)
+{
+	uint32_t seq = s->msr_seq[i];
+
+	if (!(on_change & (1 << i)) || !seq || s->msr_data[i]->values[0] != value)
+		return false;
+
+	return !heartbeat ||
+	       time_before(jiffies, s->msr_hist_jiffies[i][seq % LUNIX_SENSOR_HIST] + heartbeat);
 }
 
 void lunix_sensor_update(struct lunix_sensor_struct *s,
-                         uint16_t batt, uint16_t temp, uint16_t light)
+                         uint16_t batt, uint16_t temp, uint16_t light,
+                         ktime_t rx_time)
 {
+	uint16_t values[N_LUNIX_MSR] = { [BATT] = batt, [TEMP] = temp, [LIGHT] = light };
+	long converted[N_LUNIX_MSR];
+	unsigned int on_change = READ_ONCE(lunix_publish_on_change);
+	unsigned long heartbeat = READ_ONCE(lunix_heartbeat_s) * HZ;
+	uint32_t now = ktime_get_real_seconds();
+	int i, published = 0;
+
+	/* The aggregates, sketches and averages are kept in thousandths, as readers see them */
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		lunix_chrdev_convert(i, values[i], &converted[i]);
+
 	spin_lock(&s->lock);
 
-	/*
-	 * Update the raw values and the relevant timestamps.
-	 */
-	s->msr_data[BATT]->values[0] = batt;
-	s->msr_data[TEMP]->values[0] = temp;
-	s->msr_data[LIGHT]->values[0] = light;
+	/* Back from silence: clear the stale flags, and publish everything afresh */
+	s->last_seen = jiffies;
+	if (s->node_state != LUNIX_NODE_LIVE) {
+		if (s->node_state == LUNIX_NODE_STALE)
+			on_change = 0;
+		s->node_state = LUNIX_NODE_LIVE;
+		for (i = 0; i < N_LUNIX_MSR; i++)
+			s->msr_data[i]->flags &= ~LUNIX_MSR_STALE;
+	}
+
+	/* Every sample counts towards the aggregates, sketches and averages, published or not */
+	lunix_agg_update(s, converted);
+	lunix_sketch_update(s, converted);
+	for (i = 0; i < N_LUNIX_MSR; i++) {
+		s->msr_cnt[i]++;
+		s->msr_sum[i] += converted[i];
+	}
+
+	for (i = 0; i < N_LUNIX_MSR; i++) {
+		if (lunix_sensor_unchanged(s, i, values[i], on_change, heartbeat))
+			continue;
 
-	s->msr_data[BATT]->magic = s->msr_data[TEMP]->magic = s->msr_data[LIGHT]->magic = LUNIX_MSR_MAGIC;
-	s->msr_data[BATT]->last_update = s->msr_data[TEMP]->last_update = s->msr_data[LIGHT]->last_update = ktime_get_real_seconds();
+		/*
+		 * Update the raw value and the relevant timestamp.
+		 */
+		s->msr_data[i]->values[0] = values[i];
+		s->msr_data[i]->magic = LUNIX_MSR_MAGIC;
+		s->msr_data[i]->last_update = now;
+
+		/*
+		 * Account for the new sample, for readers that
+		 * decimate or batch the stream.
+		 */
+		s->msr_seq[i]++;
+		s->msr_hist[i][s->msr_seq[i] % LUNIX_SENSOR_HIST] = values[i];
+		s->msr_hist_jiffies[i][s->msr_seq[i] % LUNIX_SENSOR_HIST] = jiffies;
+		published++;
+	}
+
+	if (published) {
+		s->rx_time = rx_time;
+		s->publish_time = lunix_latency_now();
+	}
 
 	spin_unlock(&s->lock);
 
+	trace_lunix_sensor_update(s - lunix_sensors, batt, temp, light);
+	lunix_stat_inc(LUNIX_STAT_UPDATES);
+	lunix_stat_node_update(s - lunix_sensors);
+	if (published < N_LUNIX_MSR)
+		lunix_stat_add(LUNIX_STAT_UNCHANGED, N_LUNIX_MSR - published);
+
+	/* Watch for the node going silent, unless already watching */
+	if (READ_ONCE(lunix_stale_timeout_s))
+		schedule_delayed_work(&lunix_stale_work, LUNIX_STALE_CHECK_PERIOD);
+
 	/*
-	 * And wake up any sleepers who may be waiting on
-	 * fresh data from this sensor.
+	 * And mark the sensor, so that any sleepers who may be waiting
+	 * on fresh data from it are woken up at the end of the batch.
+	 * Nothing to wake them up for if nothing changed.
 	 */
-	wake_up_interruptible(&s->wq);
+	if (published)
+		set_bit(s - lunix_sensors, lunix_sensors_pending);
+}
+
+/*
+ * Wakes up the sleepers of every sensor updated since the last call.
+ */
+static void lunix_sensor_wake_pending(void)
+{
+	ktime_t now = lunix_latency_now();
+	int i;
+
+	for_each_set_bit(i, lunix_sensors_pending, lunix_sensor_cnt)
+		if (test_and_clear_bit(i, lunix_sensors_pending)) {
+			lunix_latency_since(LUNIX_LAT_WAKE, lunix_sensors[i].publish_time, now);
+			lunix_sensors[i].wake_time = now;
+			trace_lunix_sensor_wake(i);
+			lunix_stat_inc(LUNIX_STAT_WAKE_CALLS);
+			wake_up_interruptible(&lunix_sensors[i].wq);
+		}
+}
+
+static enum hrtimer_restart lunix_wake_timer_fn(struct hrtimer *timer)
+{
+	clear_bit(0, &lunix_wake_timer_armed);
+	lunix_sensor_wake_pending();
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called by producers at the end of every batch of data they have
+ * passed to the protocol code, to wake up the sleepers of the sensors
+ * it updated, either right away or when the coalescing window closes.
+ */
+void lunix_sensor_wake_flush(void)
+{
+	unsigned int window_us = READ_ONCE(lunix_wake_window_us);
+
+	if (!window_us) {
+		lunix_sensor_wake_pending();
+		return;
+	}
+
+	/* The first batch of the window arms the timer */
+	if (!test_and_set_bit(0, &lunix_wake_timer_armed))
+		hrtimer_start(&lunix_wake_timer, us_to_ktime(window_us), HRTIMER_MODE_REL_SOFT);
+}
+EXPORT_SYMBOL_GPL(lunix_sensor_wake_flush);
+
+/*
+ * Called by producers when a feed attaches, before they pass
+ * any data from it to the protocol code, and when it detaches.
+ * When the last feed detaches, the sleepers of every sensor are
+ * woken up, for readers to report that no data can come.
+ */
+void lunix_sensor_feed_attach(void)
+{
+	spin_lock(&lunix_feed_lock);
+	if (!lunix_feed_cnt++)
+		WRITE_ONCE(lunix_sensors_feed_state, LUNIX_FEED_UP);
+	spin_unlock(&lunix_feed_lock);
+}
+EXPORT_SYMBOL_GPL(lunix_sensor_feed_attach);
+
+void lunix_sensor_feed_detach(void)
+{
+	bool down;
+	int i;
+
+	spin_lock(&lunix_feed_lock);
+	down = !--lunix_feed_cnt;
+	if (down) {
+		WRITE_ONCE(lunix_sensors_feed_downs, lunix_sensors_feed_downs + 1);
+		smp_wmb();
+		WRITE_ONCE(lunix_sensors_feed_state, LUNIX_FEED_DOWN);
+	}
+	spin_unlock(&lunix_feed_lock);
+
+	if (!down)
+		return;
+
+	debug("last feed detached\n");
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		wake_up_interruptible(&lunix_sensors[i].wq);
+}
+EXPORT_SYMBOL_GPL(lunix_sensor_feed_detach);
+
+/*
+ * Marks the nodes silent for longer than the stale timeout as stale,
+ * and wakes up their readers, which report it. Runs again as long as
+ * any node is still live.
+ */
+static void lunix_sensor_stale_work_fn(struct work_struct *work)
+{
+	unsigned long timeout = READ_ONCE(lunix_stale_timeout_s) * HZ;
+	struct lunix_sensor_struct *s;
+	int i, j, live = 0;
+	bool stale;
+
+	if (!timeout)
+		return;
+
+	for (i = 0; i < lunix_sensor_cnt; i++) {
+		s = &lunix_sensors[i];
+		stale = false;
+
+		spin_lock(&s->lock);
+		if (s->node_state == LUNIX_NODE_LIVE) {
+			if (time_after_eq(jiffies, s->last_seen + timeout)) {
+				s->node_state = LUNIX_NODE_STALE;
+				s->stale_cnt++;
+				for (j = 0; j < N_LUNIX_MSR; j++)
+					s->msr_data[j]->flags |= LUNIX_MSR_STALE;
+				stale = true;
+			} else {
+				live++;
+			}
+		}
+		spin_unlock(&s->lock);
+
+		if (stale) {
+			trace_lunix_sensor_stale(i);
+			lunix_stat_inc(LUNIX_STAT_STALE);
+			wake_up_interruptible(&s->wq);
+		}
+	}
+
+	if (live)
+		schedule_delayed_work(&lunix_stale_work, LUNIX_STALE_CHECK_PERIOD);
+}
+
+/*
+ * Initialization and destruction of the wakeup coalescing,
+ * liveness tracking and feed state, shared by all sensors
+ */
+int lunix_sensor_wake_init(void)
+{
+	lunix_sensors_pending = bitmap_zalloc(lunix_sensor_cnt, GFP_KERNEL);
+	if (!lunix_sensors_pending)
+		return -ENOMEM;
+
+	hrtimer_init(&lunix_wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	lunix_wake_timer.function = lunix_wake_timer_fn;
+	lunix_wake_timer_armed = 0;
+
+	INIT_DEFERRABLE_WORK(&lunix_stale_work, lunix_sensor_stale_work_fn);
+
+	spin_lock_init(&lunix_feed_lock);
+	lunix_feed_cnt = 0;
+	lunix_sensors_feed_state = LUNIX_FEED_NONE;
+	lunix_sensors_feed_downs = 0;
+
+	return 0;
+}
+
+void lunix_sensor_wake_destroy(void)
+{
+	cancel_delayed_work_sync(&lunix_stale_work);
+	hrtimer_cancel(&lunix_wake_timer);
+	bitmap_free(lunix_sensors_pending);
 }
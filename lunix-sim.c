@@ -0,0 +1,481 @@
+/*
+ * lunix-sim.c
+ *
+ * A local stand-in for the XMesh base station of Lunix:TNG:
+ * serves a stream of sensor packets from N simulated nodes over
+ * TCP, on a pty, or to a file, so that the driver can be tested
+ * and loaded without the remote TCP endpoint.
+ *
+ * Besides well-behaved traffic, it can add jitter, duplicate
+ * packets, corrupted bytes and bursts, or offer packets open-loop
+ * at a fixed (or ramping) rate, dropping whatever the output
+ * cannot take, to find where the driver's pipeline falls over.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "lunix-xmesh.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * A simulated node: its sequence number, the raw values
+ * it random-walks through, and when it next transmits.
+ */
+struct sim_node {
+	uint16_t id;
+	uint16_t seqno;
+	uint16_t batt, temp, light;
+	long long next;
+};
+
+/*
+ * Configuration, from the command line
+ */
+static int nr_nodes = 16;
+static double node_rate = 1.0;
+static int jitter_pct = 10;
+static int dup_pct;
+static int corrupt_pct;
+static int burst = 1;
+static int escape_pct;
+static double sat_rate;
+static double sat_step;
+static int duration;
+
+/*
+ * Counters, reported on exit and, in saturation mode, every second
+ */
+static struct {
+	unsigned long long packets, bytes, dups, corrupted, dropped;
+} stats;
+
+static volatile sig_atomic_t done;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(long long t)
+{
+	struct timespec ts = { .tv_sec = t / NSEC_PER_SEC, .tv_nsec = t % NSEC_PER_SEC };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !done)
+		;
+}
+
+static int percent(int pct)
+{
+	return pct > 0 && random() % 100 < pct;
+}
+
+/*
+ * Moves a raw value by a few units, staying within [lo, hi]
+ */
+static uint16_t walk(uint16_t v, int lo, int hi)
+{
+	int n = v + (int)(random() % 7) - 3;
+
+	return n < lo ? lo : n > hi ? hi : n;
+}
+
+/*
+ * Forces a value's bytes to special characters with a probability
+ * of escape_pct percent each, to exercise the parser's unescaping.
+ */
+static uint16_t maybe_escape(uint16_t v)
+{
+	if (percent(escape_pct))
+		v = (v & 0xFF00) | ((random() & 1) ? XMESH_SYNC_BYTE : XMESH_ESCAPE_BYTE);
+	if (percent(escape_pct))
+		v = (v & 0x00FF) | ((random() & 1) ? XMESH_SYNC_BYTE : XMESH_ESCAPE_BYTE) << 8;
+	return v;
+}
+
+/*
+ * Builds the next packet of a node into `wire', possibly
+ * corrupting one of its bytes. Returns its length.
+ */
+static size_t node_packet(struct sim_node *node, uint8_t *wire)
+{
+	size_t n;
+
+	node->batt = walk(node->batt, 0x100, 0x1FF);
+	node->temp = walk(node->temp, 0x000, 0x3FF);
+	node->light = walk(node->light, 0x000, 0x3FF);
+
+	n = xmesh_sensor_packet(wire, node->id, node->seqno++, maybe_escape(node->batt),
+	                        maybe_escape(node->temp), maybe_escape(node->light));
+
+	/* Line noise: flip some bits of any byte but the leading sync byte */
+	if (percent(corrupt_pct)) {
+		wire[1 + random() % (n - 1)] ^= 1 + random() % 255;
+		stats.corrupted++;
+	}
+
+	return n;
+}
+
+/*
+ * Writes a whole buffer to a blocking output.
+ * Returns 0, or -1 if the other end went away.
+ */
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR && !done)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Paced mode: every node transmits `node_rate' times per second,
+ * give or take the jitter, `burst' packets at a time.
+ * Returns when the output fails, or when the run is over.
+ */
+static int run_paced(int fd, struct sim_node *nodes, long long end)
+{
+	uint8_t wire[XMESH_MAX_WIRE];
+	long long period = NSEC_PER_SEC / node_rate;
+	long long t, j;
+	struct sim_node *node;
+	size_t n;
+	int i, b;
+
+	/* Nodes start spread over the first period */
+	t = now_ns();
+	for (i = 0; i < nr_nodes; i++)
+		nodes[i].next = t + period * i / nr_nodes;
+
+	while (!done) {
+		node = &nodes[0];
+		for (i = 1; i < nr_nodes; i++)
+			if (nodes[i].next < node->next)
+				node = &nodes[i];
+		if (end && node->next >= end)
+			return 0;
+
+		sleep_until(node->next);
+		if (done)
+			break;
+
+		for (b = 0; b < burst; b++) {
+			n = node_packet(node, wire);
+			if (write_all(fd, wire, n) < 0)
+				return -1;
+			stats.packets++;
+			stats.bytes += n;
+
+			/* As if a mesh retransmission got through twice */
+			if (percent(dup_pct)) {
+				if (write_all(fd, wire, n) < 0)
+					return -1;
+				stats.dups++;
+				stats.bytes += n;
+			}
+		}
+
+		j = jitter_pct ? period * jitter_pct / 100 : 0;
+		node->next += period * burst + (j ? (long long)(random() % (2 * j + 1)) - j : 0);
+	}
+
+	return 0;
+}
+
+/*
+ * Saturation mode: offer packets from all nodes round-robin at a fixed
+ * total rate, whatever happens downstream. The output is non-blocking,
+ * and whole packets that do not fit are dropped at the source, as a
+ * UART without flow control would overrun.
+ */
+static int run_saturation(int fd, struct sim_node *nodes, long long end)
+{
+	uint8_t wire[XMESH_MAX_WIRE];
+	unsigned long long offered = 0, due, last_packets = 0, last_dropped = 0;
+	long long start, t, tick = NSEC_PER_SEC / 1000, second;
+	double rate = sat_rate, base = 0;
+	size_t n, off;
+	ssize_t w;
+	int i = 0;
+
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		return -1;
+	}
+
+	start = t = now_ns();
+	second = start + NSEC_PER_SEC;
+	while (!done && (!end || t < end)) {
+		t = now_ns();
+		due = base + rate * (t - start) / NSEC_PER_SEC;
+
+		for (; offered < due && !done; offered++, i = (i + 1) % nr_nodes) {
+			n = node_packet(&nodes[i], wire);
+
+			/* Once a packet is started, it has to be finished */
+			for (off = 0; off < n; off += w) {
+				w = write(fd, wire + off, n - off);
+				if (w >= 0)
+					continue;
+				if (errno == EAGAIN && off == 0)
+					break;
+				if (errno == EAGAIN || errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				return -1;
+			}
+			if (off < n) {
+				stats.dropped++;
+				continue;
+			}
+			stats.packets++;
+			stats.bytes += n;
+		}
+
+		if (t >= second) {
+			fprintf(stderr, "offered %.0f/s: sent %llu, dropped %llu\n", rate,
+			        stats.packets - last_packets, stats.dropped - last_dropped);
+			last_packets = stats.packets;
+			last_dropped = stats.dropped;
+			second += NSEC_PER_SEC;
+
+			/* Ramp up, keeping the packets offered so far */
+			if (sat_step > 0) {
+				base += rate * (t - start) / NSEC_PER_SEC;
+				start = t;
+				rate += sat_step;
+			}
+		}
+
+		sleep_until(t + tick);
+	}
+
+	return 0;
+}
+
+static int run(int fd, struct sim_node *nodes, long long end)
+{
+	return sat_rate > 0 ? run_saturation(fd, nodes, end) : run_paced(fd, nodes, end);
+}
+
+/*
+ * Serves the stream to one TCP client at a time, as the base station's
+ * TCP endpoint does. The nodes carry on from where they were when a
+ * client disconnects.
+ */
+static int serve_tcp(const char *spec, struct sim_node *nodes, long long end)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+	                          .ai_flags = AI_PASSIVE };
+	struct addrinfo *ai;
+	char host[256] = "", *port;
+	int sfd, cfd, one = 1, ret;
+
+	/* [host:]port */
+	port = strrchr(spec, ':');
+	if (port) {
+		snprintf(host, sizeof(host), "%.*s", (int)(port - spec), spec);
+		port++;
+	} else {
+		port = (char *)spec;
+	}
+
+	if ((ret = getaddrinfo(*host ? host : NULL, port, &hints, &ai)) != 0) {
+		fprintf(stderr, "%s: %s\n", spec, gai_strerror(ret));
+		return -1;
+	}
+	sfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sfd < 0 ||
+	    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    bind(sfd, ai->ai_addr, ai->ai_addrlen) < 0 ||
+	    listen(sfd, 1) < 0) {
+		perror(spec);
+		freeaddrinfo(ai);
+		return -1;
+	}
+	freeaddrinfo(ai);
+
+	while (!done) {
+		fprintf(stderr, "Waiting for a client on %s...\n", spec);
+		if ((cfd = accept(sfd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fprintf(stderr, "Client connected, streaming\n");
+
+		ret = run(cfd, nodes, end);
+		close(cfd);
+		if (ret == 0)
+			break;
+		fprintf(stderr, "Client went away\n");
+	}
+
+	close(sfd);
+	return 0;
+}
+
+/*
+ * Serves the stream on the master side of a new pty. Attach the
+ * line discipline to the slave side printed, with lunix-attach.
+ */
+static int serve_pty(struct sim_node *nodes, long long end)
+{
+	struct termios tio;
+	int fd;
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+
+	/* No echo or line editing on the way through */
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	printf("%s\n", ptsname(fd));
+	fflush(stdout);
+	fprintf(stderr, "Streaming to %s, attach with: ./lunix-attach %s\n", ptsname(fd), ptsname(fd));
+
+	run(fd, nodes, end);
+	close(fd);
+	return 0;
+}
+
+static void sig_done(int sig)
+{
+	done = 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] {-l [host:]port | -p | -o file}\n\n"
+	        "  -l [host:]port  serve the stream over TCP, one client at a time\n"
+	        "  -p              serve the stream on a new pty, whose name is printed\n"
+	        "  -o file         write the stream to a file, - for stdout\n\n"
+	        "  -n nodes        number of nodes (default 16)\n"
+	        "  -r rate         packets per second, per node (default 1)\n"
+	        "  -j jitter       jitter, in percent of the period (default 10)\n"
+	        "  -d dup_pct      percentage of packets sent twice (default 0)\n"
+	        "  -c corrupt_pct  percentage of packets with a corrupted byte (default 0)\n"
+	        "  -b burst        packets sent back-to-back per transmission, at the\n"
+	        "                  same average rate (default 1)\n"
+	        "  -e escape_pct   percentage of measurement bytes forced to special\n"
+	        "                  characters (default 0)\n"
+	        "  -S rate         open-loop saturation: offer this many packets per second\n"
+	        "                  over all nodes, dropping what the output cannot take\n"
+	        "  -R step         with -S, raise the offered rate by this much every second\n"
+	        "  -t seconds      stop after this long (default: never)\n"
+	        "  -s seed         random seed (default 1)\n",
+	        argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *listen_spec = NULL, *out_file = NULL;
+	struct sim_node *nodes;
+	long long end = 0;
+	int use_pty = 0, fd, opt, i, ret;
+	unsigned int seed = 1;
+
+	while ((opt = getopt(argc, argv, "l:po:n:r:j:d:c:b:e:S:R:t:s:")) != -1) {
+		switch (opt) {
+		case 'l': listen_spec = optarg; break;
+		case 'p': use_pty = 1; break;
+		case 'o': out_file = optarg; break;
+		case 'n': nr_nodes = atoi(optarg); break;
+		case 'r': node_rate = atof(optarg); break;
+		case 'j': jitter_pct = atoi(optarg); break;
+		case 'd': dup_pct = atoi(optarg); break;
+		case 'c': corrupt_pct = atoi(optarg); break;
+		case 'b': burst = atoi(optarg); break;
+		case 'e': escape_pct = atoi(optarg); break;
+		case 'S': sat_rate = atof(optarg); break;
+		case 'R': sat_step = atof(optarg); break;
+		case 't': duration = atoi(optarg); break;
+		case 's': seed = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!!listen_spec + use_pty + !!out_file != 1 || optind != argc)
+		usage(argv[0]);
+	if (nr_nodes < 1 || nr_nodes > 65534 || node_rate <= 0 || burst < 1 ||
+	    jitter_pct < 0 || jitter_pct > 100 || sat_rate < 0 || duration < 0)
+		usage(argv[0]);
+
+	srandom(seed);
+	nodes = calloc(nr_nodes, sizeof(*nodes));
+	if (!nodes) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nr_nodes; i++) {
+		nodes[i].id = i + 1;
+		nodes[i].batt = 0x100 + random() % 0x100;
+		nodes[i].temp = random() % 0x400;
+		nodes[i].light = random() % 0x400;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, sig_done);
+	signal(SIGTERM, sig_done);
+	if (duration)
+		end = now_ns() + duration * NSEC_PER_SEC;
+
+	if (listen_spec) {
+		ret = serve_tcp(listen_spec, nodes, end);
+	} else if (use_pty) {
+		ret = serve_pty(nodes, end);
+	} else {
+		fd = strcmp(out_file, "-") ? open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+		if (fd < 0) {
+			perror(out_file);
+			return 1;
+		}
+		ret = run(fd, nodes, end);
+		close(fd);
+	}
+
+	fprintf(stderr, "%llu packets, %llu bytes, %llu duplicates, %llu corrupted, %llu dropped\n",
+	        stats.packets, stats.bytes, stats.dups, stats.corrupted, stats.dropped);
+
+	free(nodes);
+	return ret < 0;
+}
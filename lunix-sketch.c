@@ -0,0 +1,195 @@
+/*
+ * lunix-sketch.c
+ *
+ * Quantile sketches of every measurement of every sensor, in fixed
+ * memory, mergeable across nodes, for Lunix:TNG. In the manner of
+ * DDSketch, values are counted in buckets of bounded relative width,
+ * so any quantile is known to within the width of a bucket.
+ */
+
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+
+#include "lunix.h"
+#include "lunix-sketch.h"
+
+/*
+ * Returns the bucket of a magnitude, see lunix-sketch.h
+ */
+static unsigned int lunix_sketch_index(unsigned long v)
+{
+	unsigned int e;
+
+	v = min(v, (1UL << LUNIX_SKETCH_MAX_BITS) - 1);
+	if (v < (1UL << LUNIX_SKETCH_SUB_BITS))
+		return v;
+
+	e = fls(v) - 1;
+	return ((e - LUNIX_SKETCH_SUB_BITS + 1) << LUNIX_SKETCH_SUB_BITS) +
+	       (v >> (e - LUNIX_SKETCH_SUB_BITS)) - (1 << LUNIX_SKETCH_SUB_BITS);
+}
+
+/*
+ * Returns the magnitude a bucket stands for: the midpoint of its range
+ */
+static unsigned long lunix_sketch_value(unsigned int i)
+{
+	unsigned int e, shift;
+
+	if (i < (1 << LUNIX_SKETCH_SUB_BITS))
+		return i;
+
+	e = (i >> LUNIX_SKETCH_SUB_BITS) + LUNIX_SKETCH_SUB_BITS - 1;
+	shift = e - LUNIX_SKETCH_SUB_BITS;
+	return (((unsigned long)(i & ((1 << LUNIX_SKETCH_SUB_BITS) - 1)) +
+	         (1 << LUNIX_SKETCH_SUB_BITS)) << shift) + ((1UL << shift) >> 1);
+}
+
+static void lunix_sketch_add(struct lunix_sketch *sk, long value)
+{
+	if (!sk->count || value < sk->min)
+		sk->min = value;
+	if (!sk->count || value > sk->max)
+		sk->max = value;
+	sk->count++;
+
+	if (value < 0)
+		sk->neg[lunix_sketch_index(-value)]++;
+	else
+		sk->pos[lunix_sketch_index(value)]++;
+}
+
+static void lunix_sketch_merge(struct lunix_sketch *dst, const struct lunix_sketch *src)
+{
+	int i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (!dst->count || src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+
+	for (i = 0; i < LUNIX_SKETCH_BUCKETS; i++) {
+		dst->neg[i] += src->neg[i];
+		dst->pos[i] += src->pos[i];
+	}
+}
+
+/*
+ * Adds the latest values of every measurement, in thousandths
+ * of their units, to their sketches. O(1) per sample.
+ * Called with the sensor's lock held.
+ */
+void lunix_sketch_update(struct lunix_sensor_struct *s, const long *values)
+{
+	int i;
+
+	for (i = 0; i < N_LUNIX_MSR; i++)
+		lunix_sketch_add(&s->sketch[i], values[i]);
+}
+
+/*
+ * Merges the sketches of a measurement over a set of sensors into
+ * `sk', resetting each of them right after, under its lock, if asked
+ * to, so that no sample is lost or counted twice between two calls.
+ *
+ * Returns:
+ * - 0 on success
+ * - -EINVAL if a sensor number is out of range or repeated
+ * - -ENOMEM if out of memory
+ */
+int lunix_sketch_collect(struct lunix_sketch *sk, enum lunix_msr_enum type,
+                         const uint32_t *nodes, unsigned int nr_nodes, bool reset)
+{
+	struct lunix_sensor_struct *s;
+	unsigned long *seen;
+	unsigned int i;
+	int ret = 0;
+
+	/* Check the whole set first, so that nothing is reset on errors */
+	seen = bitmap_zalloc(lunix_sensor_cnt, GFP_KERNEL);
+	if (!seen)
+		return -ENOMEM;
+	for (i = 0; i < nr_nodes; i++) {
+		if (nodes[i] >= lunix_sensor_cnt || test_and_set_bit(nodes[i], seen)) {
+			ret = -EINVAL;
+			break;
+		}
+	}
+	bitmap_free(seen);
+	if (ret < 0)
+		return ret;
+
+	memset(sk, 0, sizeof(*sk));
+	for (i = 0; i < nr_nodes; i++) {
+		s = &lunix_sensors[nodes[i]];
+		spin_lock_irq(&s->lock);
+		lunix_sketch_merge(sk, &s->sketch[type]);
+		if (reset)
+			memset(&s->sketch[type], 0, sizeof(s->sketch[type]));
+		spin_unlock_irq(&s->lock);
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the q-th quantile (in per mille) of the values in a sketch,
+ * in thousandths of their unit, or 0 for an empty sketch. The bucket
+ * of the value of rank q * (count - 1) / 1000 is found by walking the
+ * buckets in order of value; the estimate is kept within the exact
+ * minimum and maximum, so the 0th and 1000th quantiles are exact.
+ */
+long lunix_sketch_quantile(const struct lunix_sketch *sk, unsigned int q)
+{
+	u64 rank, seen = 0;
+	int i;
+
+	if (!sk->count)
+		return 0;
+	if (q == 0)
+		return sk->min;
+	if (q >= 1000)
+		return sk->max;
+
+	rank = div_u64((sk->count - 1) * q, 1000);
+	for (i = LUNIX_SKETCH_BUCKETS - 1; i >= 0; i--) {
+		seen += sk->neg[i];
+		if (seen > rank)
+			return clamp(-(long)lunix_sketch_value(i), sk->min, sk->max);
+	}
+	for (i = 0; i < LUNIX_SKETCH_BUCKETS; i++) {
+		seen += sk->pos[i];
+		if (seen > rank)
+			return clamp((long)lunix_sketch_value(i), sk->min, sk->max);
+	}
+
+	return sk->max;
+}
+
+/*
+ * Initialization and destruction of the sketches of a sensor
+ */
+int lunix_sketch_init(struct lunix_sensor_struct *s)
+{
+	s->sketch = kcalloc(N_LUNIX_MSR, sizeof(*s->sketch), GFP_KERNEL);
+	if (!s->sketch)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void lunix_sketch_destroy(struct lunix_sensor_struct *s)
+{
+	kfree(s->sketch);
+	s->sketch = NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * lunix-sketch.h
+ *
+ * Definition file for the quantile sketches
+ * of Lunix:TNG measurements
+ */
+
+#ifndef _LUNIX_SKETCH_H
+#define _LUNIX_SKETCH_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+
+#include "lunix.h"
+
+/*
+ * Buckets are log-linear in the magnitude of the values, in thousandths
+ * of their unit: values below 2^LUNIX_SKETCH_SUB_BITS have a bucket each,
+ * and every power of two above is split into 2^LUNIX_SKETCH_SUB_BITS
+ * buckets of equal width. A bucket is thus at most 1/32nd of its values
+ * wide, and its midpoint within 1/64th of any of them. Magnitudes from
+ * 2^LUNIX_SKETCH_MAX_BITS up, beyond any lookup table, share the last one.
+ */
+#define LUNIX_SKETCH_SUB_BITS 5
+#define LUNIX_SKETCH_MAX_BITS 23
+#define LUNIX_SKETCH_BUCKETS \
+	((LUNIX_SKETCH_MAX_BITS - LUNIX_SKETCH_SUB_BITS + 1) << LUNIX_SKETCH_SUB_BITS)
+
+/*
+ * The sketch of a measurement: the number of values added, their
+ * exact minimum and maximum, and how many fell into every bucket,
+ * for negative and for other values. Sketches merge by adding them
+ * up, bucket by bucket.
+ */
+struct lunix_sketch {
+	u64 count;
+	long min;
+	long max;
+	u32 neg[LUNIX_SKETCH_BUCKETS];
+	u32 pos[LUNIX_SKETCH_BUCKETS];
+};
+
+/*
+ * Function prototypes
+ */
+int lunix_sketch_init(struct lunix_sensor_struct *s);
+void lunix_sketch_destroy(struct lunix_sensor_struct *s);
+void lunix_sketch_update(struct lunix_sensor_struct *s, const long *values);
+int lunix_sketch_collect(struct lunix_sketch *sk, enum lunix_msr_enum type,
+                         const uint32_t *nodes, unsigned int nr_nodes, bool reset);
+long lunix_sketch_quantile(const struct lunix_sketch *sk, unsigned int q);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LUNIX_SKETCH_H */
@@ -0,0 +1,311 @@
+/*
+ * lunix-stats.c
+ *
+ * Per-CPU hot path statistics
+ * for Lunix:TNG
+ */
+
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/kobject.h>
+#include <linux/seq_file.h>
+#include <linux/sysfs.h>
+
+#include "lunix.h"
+#include "lunix-stats.h"
+
+DEFINE_PER_CPU(struct lunix_stats_struct, lunix_stats);
+DEFINE_PER_CPU(struct lunix_latency_struct, lunix_latency);
+u64 __percpu *lunix_stats_node_updates;
+struct dentry *lunix_debugfs_dir;
+EXPORT_SYMBOL_GPL(lunix_debugfs_dir);
+
+DEFINE_STATIC_KEY_FALSE(lunix_latency_key);
+EXPORT_SYMBOL_GPL(lunix_latency_key);
+
+static int lunix_latency_param_set(const char *val, const struct kernel_param *kp)
+{
+	bool enable;
+	int ret;
+
+	if ((ret = kstrtobool(val, &enable)) < 0)
+		return ret;
+
+	if (enable)
+		static_branch_enable(&lunix_latency_key);
+	else
+		static_branch_disable(&lunix_latency_key);
+
+	return 0;
+}
+
+static int lunix_latency_param_get(char *buf, const struct kernel_param *kp)
+{
+	return sysfs_emit(buf, "%d\n", static_key_enabled(&lunix_latency_key));
+}
+
+static const struct kernel_param_ops lunix_latency_param_ops = {
+	.set = lunix_latency_param_set,
+	.get = lunix_latency_param_get,
+};
+module_param_cb(lunix_latency, &lunix_latency_param_ops, NULL, 0644);
+MODULE_PARM_DESC(lunix_latency, "Keep end-to-end latency histograms");
+
+static const char * const lunix_lat_names[N_LUNIX_LAT] = {
+	[LUNIX_LAT_PARSE]      = "parse_ns",
+	[LUNIX_LAT_PUBLISH]    = "publish_ns",
+	[LUNIX_LAT_WAKE]       = "wake_ns",
+	[LUNIX_LAT_SCHED]      = "sched_ns",
+	[LUNIX_LAT_COPY]       = "copy_ns",
+	[LUNIX_LAT_E2E]        = "e2e_ns",
+	[LUNIX_LAT_PARSER_CPB] = "parser_cycles_per_byte",
+};
+
+static const char * const lunix_stat_names[N_LUNIX_STAT] = {
+	[LUNIX_STAT_RX_BYTES]        = "rx_bytes",
+	[LUNIX_STAT_RX_BATCHES]      = "rx_batches",
+	[LUNIX_STAT_FIFO_DROPS]      = "fifo_drops",
+	[LUNIX_STAT_FRAMES]          = "frames",
+	[LUNIX_STAT_SENSOR_FRAMES]   = "sensor_frames",
+	[LUNIX_STAT_CRC_ERRORS]      = "crc_errors",
+	[LUNIX_STAT_OVERFLOWS]       = "overflows",
+	[LUNIX_STAT_BAD_NODE]        = "bad_node",
+	[LUNIX_STAT_DUPLICATES]      = "duplicates",
+	[LUNIX_STAT_STANDBY_HELD]    = "standby_held",
+	[LUNIX_STAT_FAILOVERS]       = "failovers",
+	[LUNIX_STAT_UPDATES]         = "updates",
+	[LUNIX_STAT_UNCHANGED]       = "unchanged",
+	[LUNIX_STAT_STALE]           = "stale",
+	[LUNIX_STAT_WAKE_CALLS]      = "wake_calls",
+	[LUNIX_STAT_READER_WAKEUPS]  = "reader_wakeups",
+	[LUNIX_STAT_READER_FILTERED] = "reader_filtered",
+	[LUNIX_STAT_READS]           = "reads",
+	[LUNIX_STAT_READ_BYTES]      = "read_bytes",
+	[LUNIX_STAT_TAP_DROPS]       = "tap_drops",
+	[LUNIX_STAT_FEED_BYTES]      = "feed_bytes",
+	[LUNIX_STAT_TCP_BYTES]       = "tcp_bytes",
+	[LUNIX_STAT_TCP_CONNECTS]    = "tcp_connects",
+	[LUNIX_STAT_TX_COMMANDS]     = "tx_commands",
+};
+
+/*
+ * sysfs attributes, one file per counter under /sys/kernel/lunix/stats
+ */
+struct lunix_stat_attribute {
+	struct kobj_attribute attr;
+	enum lunix_stat_enum item;
+};
+
+static struct kobject *lunix_kobj;
+static struct lunix_stat_attribute *lunix_stat_attrs;
+static struct attribute **lunix_stat_attr_list;
+static struct attribute_group lunix_stat_group = {
+	.name = "stats",
+};
+
+/*
+ * Sum up a counter over all CPUs
+ */
+u64 lunix_stat_read(enum lunix_stat_enum item)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(lunix_stats, cpu).cnt[item];
+
+	return sum;
+}
+EXPORT_SYMBOL_GPL(lunix_stat_read);
+
+u64 lunix_stat_read_node(int sensor_num)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu_ptr(lunix_stats_node_updates, cpu)[sensor_num];
+
+	return sum;
+}
+
+/*
+ * Sum up the histogram of a stage over all CPUs into `bucket`,
+ * and return the total number of samples in it
+ */
+u64 lunix_latency_read(enum lunix_lat_enum stage, u64 *bucket)
+{
+	u64 total = 0;
+	int cpu, i;
+
+	for (i = 0; i < LUNIX_LAT_BUCKETS; i++) {
+		bucket[i] = 0;
+		for_each_possible_cpu(cpu)
+			bucket[i] += per_cpu(lunix_latency, cpu).bucket[stage][i];
+		total += bucket[i];
+	}
+
+	return total;
+}
+EXPORT_SYMBOL_GPL(lunix_latency_read);
+
+/*
+ * Return the upper bound of the bucket holding the given
+ * percentile (in per mille) of a histogram of `total` samples
+ */
+u64 lunix_latency_percentile(const u64 *bucket, u64 total, int permille)
+{
+	u64 sum;
+	int i;
+
+	for (sum = 0, i = 0; i < LUNIX_LAT_BUCKETS - 1; i++) {
+		sum += bucket[i];
+		if (sum * 1000 >= total * permille)
+			break;
+	}
+
+	return 1ULL << i;
+}
+EXPORT_SYMBOL_GPL(lunix_latency_percentile);
+
+static ssize_t lunix_stat_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct lunix_stat_attribute *sattr;
+
+	sattr = container_of(attr, struct lunix_stat_attribute, attr);
+	return sysfs_emit(buf, "%llu\n", lunix_stat_read(sattr->item));
+}
+
+/*
+ * /sys/kernel/debug/lunix/stats: all counters, and updates per sensor
+ */
+static int lunix_stats_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < N_LUNIX_STAT; i++)
+		seq_printf(m, "%-16s %llu\n", lunix_stat_names[i], lunix_stat_read(i));
+	for (i = 0; i < lunix_sensor_cnt; i++)
+		seq_printf(m, "sensor%-10d %llu\n", i, lunix_stat_read_node(i));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lunix_stats);
+
+/*
+ * /sys/kernel/debug/lunix/latency: the non-empty buckets of every
+ * histogram, with percentiles rounded up to the bucket's upper bound.
+ * Writing anything to it resets the histograms.
+ */
+static int lunix_latency_show(struct seq_file *m, void *v)
+{
+	static const int permille[] = { 500, 900, 990, 999 };
+	static const char * const pct_names[] = { "p50", "p90", "p99", "p99.9" };
+	u64 bucket[LUNIX_LAT_BUCKETS];
+	u64 total;
+	int stage, i, p;
+
+	for (stage = 0; stage < N_LUNIX_LAT; stage++) {
+		total = lunix_latency_read(stage, bucket);
+
+		seq_printf(m, "%s: %llu samples\n", lunix_lat_names[stage], total);
+		if (!total)
+			continue;
+
+		for (p = 0; p < ARRAY_SIZE(permille); p++)
+			seq_printf(m, "  %-6s < %llu\n", pct_names[p],
+			           lunix_latency_percentile(bucket, total, permille[p]));
+		for (i = 0; i < LUNIX_LAT_BUCKETS; i++)
+			if (bucket[i])
+				seq_printf(m, "  [%llu, %llu) %llu\n",
+				           i ? 1ULL << (i - 1) : 0, 1ULL << i, bucket[i]);
+	}
+
+	return 0;
+}
+
+static int lunix_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lunix_latency_show, inode->i_private);
+}
+
+static ssize_t lunix_latency_write(struct file *file, const char __user *buf,
+                                   size_t cnt, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&lunix_latency, cpu), 0, sizeof(struct lunix_latency_struct));
+
+	return cnt;
+}
+
+static const struct file_operations lunix_latency_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_latency_open,
+	.read    = seq_read,
+	.write   = lunix_latency_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+int lunix_stats_init(void)
+{
+	int i;
+	int ret;
+
+	ret = -ENOMEM;
+	lunix_stats_node_updates = __alloc_percpu(sizeof(u64) * lunix_sensor_cnt, sizeof(u64));
+	if (!lunix_stats_node_updates)
+		goto out;
+
+	lunix_stat_attrs = kcalloc(N_LUNIX_STAT, sizeof(*lunix_stat_attrs), GFP_KERNEL);
+	lunix_stat_attr_list = kcalloc(N_LUNIX_STAT + 1, sizeof(*lunix_stat_attr_list), GFP_KERNEL);
+	if (!lunix_stat_attrs || !lunix_stat_attr_list)
+		goto out_with_attrs;
+
+	for (i = 0; i < N_LUNIX_STAT; i++) {
+		sysfs_attr_init(&lunix_stat_attrs[i].attr.attr);
+		lunix_stat_attrs[i].attr.attr.name = lunix_stat_names[i];
+		lunix_stat_attrs[i].attr.attr.mode = 0444;
+		lunix_stat_attrs[i].attr.show = lunix_stat_show;
+		lunix_stat_attrs[i].item = i;
+		lunix_stat_attr_list[i] = &lunix_stat_attrs[i].attr.attr;
+	}
+	lunix_stat_group.attrs = lunix_stat_attr_list;
+
+	lunix_kobj = kobject_create_and_add("lunix", kernel_kobj);
+	if (!lunix_kobj)
+		goto out_with_attrs;
+
+	if ((ret = sysfs_create_group(lunix_kobj, &lunix_stat_group)) < 0)
+		goto out_with_kobj;
+
+	/* debugfs is optional, failures are not fatal */
+	lunix_debugfs_dir = debugfs_create_dir("lunix", NULL);
+	debugfs_create_file("stats", 0444, lunix_debugfs_dir, NULL, &lunix_stats_fops);
+	debugfs_create_file("latency", 0644, lunix_debugfs_dir, NULL, &lunix_latency_fops);
+
+	return 0;
+
+out_with_kobj:
+	kobject_put(lunix_kobj);
+out_with_attrs:
+	kfree(lunix_stat_attr_list);
+	kfree(lunix_stat_attrs);
+	free_percpu(lunix_stats_node_updates);
+out:
+	return ret;
+}
+
+void lunix_stats_destroy(void)
+{
+	debugfs_remove_recursive(lunix_debugfs_dir);
+	sysfs_remove_group(lunix_kobj, &lunix_stat_group);
+	kobject_put(lunix_kobj);
+	kfree(lunix_stat_attr_list);
+	kfree(lunix_stat_attrs);
+	free_percpu(lunix_stats_node_updates);
+}
@@ -0,0 +1,145 @@
+/*
+ * lunix-stats.h
+ *
+ * Definition file for the per-CPU
+ * hot path statistics of Lunix:TNG
+ */
+
+#ifndef _LUNIX_STATS_H
+#define _LUNIX_STATS_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/jump_label.h>
+
+/*
+ * Event counters, one set per CPU. They are only
+ * summed up when read through debugfs or sysfs.
+ */
+enum lunix_stat_enum {
+	LUNIX_STAT_RX_BYTES = 0,        /* Bytes received from the TTY */
+	LUNIX_STAT_RX_BATCHES,          /* Calls to lunix_ldisc_receive_buf() */
+	LUNIX_STAT_FIFO_DROPS,          /* Bytes dropped, parser FIFO full */
+	LUNIX_STAT_FRAMES,              /* Complete XMesh packets parsed */
+	LUNIX_STAT_SENSOR_FRAMES,       /* ...of which carried measurements */
+	LUNIX_STAT_CRC_ERRORS,          /* Packets with a bad CRC */
+	LUNIX_STAT_OVERFLOWS,           /* Packet buffer overflows */
+	LUNIX_STAT_BAD_NODE,            /* Packets from out-of-range node ids */
+	LUNIX_STAT_DUPLICATES,          /* Copies of packets already received, dropped */
+	LUNIX_STAT_STANDBY_HELD,        /* Packets of standby feeds, not published */
+	LUNIX_STAT_FAILOVERS,           /* Switches to the standby feeds */
+	LUNIX_STAT_UPDATES,             /* Calls to lunix_sensor_update() */
+	LUNIX_STAT_UNCHANGED,           /* Measurements not published, unchanged */
+	LUNIX_STAT_STALE,               /* Nodes marked stale after a silence */
+	LUNIX_STAT_WAKE_CALLS,          /* Sensor wait queues woken up */
+	LUNIX_STAT_READER_WAKEUPS,      /* Readers woken up */
+	LUNIX_STAT_READER_FILTERED,     /* Reader wakeups suppressed by filters */
+	LUNIX_STAT_READS,               /* Calls to lunix_chrdev_read_iter() */
+	LUNIX_STAT_READ_BYTES,          /* Bytes copied to readers */
+	LUNIX_STAT_TAP_DROPS,           /* Records dropped, traffic tap full */
+	LUNIX_STAT_FEED_BYTES,          /* Bytes written to the feed device */
+	LUNIX_STAT_TCP_BYTES,           /* Bytes received by the TCP ingest */
+	LUNIX_STAT_TCP_CONNECTS,        /* Connections made by the TCP ingest */
+	LUNIX_STAT_TX_COMMANDS,         /* Commands sent down to the nodes */
+	N_LUNIX_STAT
+};
+
+struct lunix_stats_struct {
+	u64 cnt[N_LUNIX_STAT];
+};
+
+DECLARE_PER_CPU(struct lunix_stats_struct, lunix_stats);
+extern u64 __percpu *lunix_stats_node_updates;
+
+/*
+ * The debugfs directory of Lunix:TNG, /sys/kernel/debug/lunix
+ */
+extern struct dentry *lunix_debugfs_dir;
+
+/*
+ * Increment the counters of the local CPU. These are single
+ * instructions on most architectures, safe against preemption.
+ */
+#define lunix_stat_inc(item)     this_cpu_inc(lunix_stats.cnt[item])
+#define lunix_stat_add(item, n)  this_cpu_add(lunix_stats.cnt[item], (n))
+
+static inline void lunix_stat_node_update(int sensor_num)
+{
+	this_cpu_inc(lunix_stats_node_updates[sensor_num]);
+}
+
+/*
+ * Latency histograms, one set per CPU, with log2-sized buckets:
+ * bucket i counts values in [2^(i-1), 2^i). All stages are in
+ * nanoseconds, except for the parser cost, in CPU cycles per byte.
+ */
+enum lunix_lat_enum {
+	LUNIX_LAT_PARSE = 0,            /* First byte of a frame to frame complete */
+	LUNIX_LAT_PUBLISH,              /* Frame complete to sensor updated */
+	LUNIX_LAT_WAKE,                 /* Sensor updated to wait queue woken up */
+	LUNIX_LAT_SCHED,                /* Wait queue woken up to reader running */
+	LUNIX_LAT_COPY,                 /* Reader running to data copied out */
+	LUNIX_LAT_E2E,                  /* First byte of a frame to data copied out */
+	LUNIX_LAT_PARSER_CPB,           /* Parser cost, cycles per byte */
+	N_LUNIX_LAT
+};
+
+#define LUNIX_LAT_BUCKETS 64
+
+struct lunix_latency_struct {
+	u64 bucket[N_LUNIX_LAT][LUNIX_LAT_BUCKETS];
+};
+
+DECLARE_PER_CPU(struct lunix_latency_struct, lunix_latency);
+
+/*
+ * Timestamps are only taken while the lunix_latency module parameter
+ * is set; otherwise the checks below are patched out of the hot path.
+ */
+DECLARE_STATIC_KEY_FALSE(lunix_latency_key);
+
+static inline bool lunix_latency_enabled(void)
+{
+	return static_branch_unlikely(&lunix_latency_key);
+}
+
+static inline ktime_t lunix_latency_now(void)
+{
+	return lunix_latency_enabled() ? ktime_get() : 0;
+}
+
+static inline void lunix_latency_record(enum lunix_lat_enum stage, s64 value)
+{
+	int i = value > 0 ? min(fls64(value), LUNIX_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(lunix_latency.bucket[stage][i]);
+}
+
+/*
+ * Records the time elapsed since a timestamp taken with
+ * lunix_latency_now(), unless it was taken with the histograms off.
+ */
+static inline void lunix_latency_since(enum lunix_lat_enum stage, ktime_t then, ktime_t now)
+{
+	if (then && now)
+		lunix_latency_record(stage, ktime_to_ns(ktime_sub(now, then)));
+}
+
+/*
+ * Function prototypes
+ */
+u64 lunix_stat_read(enum lunix_stat_enum item);
+u64 lunix_stat_read_node(int sensor_num);
+u64 lunix_latency_read(enum lunix_lat_enum stage, u64 *bucket);
+u64 lunix_latency_percentile(const u64 *bucket, u64 total, int permille);
+int lunix_stats_init(void);
+void lunix_stats_destroy(void);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LUNIX_STATS_H */
@@ -0,0 +1,271 @@
+/*
+ * lunix-tap.c
+ *
+ * Traffic taps for Lunix:TNG: misc devices through which a single
+ * reader can watch the raw bytes received from the TTY, or the
+ * frames decoded from them, without slowing down either.
+ */
+
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/miscdevice.h>
+
+#include "lunix.h"
+#include "lunix-tap.h"
+#include "lunix-stats.h"
+
+static unsigned int lunix_tap_size = 256;
+module_param(lunix_tap_size, uint, 0444);
+MODULE_PARM_DESC(lunix_tap_size, "Buffer size of each traffic tap, in KiB");
+
+/*
+ * A tap: a FIFO of records filled by the receive path and drained
+ * by the one process that has the device open. Several parsers may
+ * complete frames concurrently, so producers serialize on `lock`;
+ * readers of the same file serialize on `read_lock`.
+ */
+struct lunix_tap_struct {
+	struct miscdevice misc;
+	struct static_key_false *key;
+
+	DECLARE_KFIFO_PTR(fifo, unsigned char);
+	spinlock_t lock;
+	uint32_t lost;                  /* Records dropped since the last one queued */
+
+	struct mutex read_lock;
+	wait_queue_head_t wq;
+	atomic_t available;
+};
+
+DEFINE_STATIC_KEY_FALSE(lunix_tap_raw_key);
+DEFINE_STATIC_KEY_FALSE(lunix_tap_frame_key);
+
+static struct lunix_tap_struct lunix_taps[2];
+
+#define lunix_tap_raw_dev   (&lunix_taps[0])
+#define lunix_tap_frame_dev (&lunix_taps[1])
+
+/*
+ * Queues a record, unless it does not fit, in which case it
+ * is only counted: the receive path never waits for the reader.
+ */
+static void lunix_tap_put(struct lunix_tap_struct *tap, int type, int flags,
+                          const unsigned char *data, int len)
+{
+	struct lunix_tap_record rec = {
+		.ts_ns = ktime_get_real_ns(),
+		.len   = len,
+		.type  = type,
+		.flags = flags,
+	};
+
+	spin_lock(&tap->lock);
+	if (kfifo_avail(&tap->fifo) < sizeof(rec) + len) {
+		tap->lost++;
+		spin_unlock(&tap->lock);
+		lunix_stat_inc(LUNIX_STAT_TAP_DROPS);
+		return;
+	}
+	rec.lost = tap->lost;
+	tap->lost = 0;
+	kfifo_in(&tap->fifo, (unsigned char *)&rec, sizeof(rec));
+	kfifo_in(&tap->fifo, data, len);
+	spin_unlock(&tap->lock);
+
+	if (wq_has_sleeper(&tap->wq))
+		wake_up_interruptible(&tap->wq);
+}
+
+void __lunix_tap_raw(const unsigned char *buf, int count)
+{
+	int len;
+
+	for (; count > 0; buf += len, count -= len) {
+		len = min(count, LUNIX_TAP_MAX_DATA);
+		lunix_tap_put(lunix_tap_raw_dev, LUNIX_TAP_RAW, 0, buf, len);
+	}
+}
+
+void __lunix_tap_frame(const unsigned char *packet, int len, int crc_ok)
+{
+	lunix_tap_put(lunix_tap_frame_dev, LUNIX_TAP_FRAME, crc_ok ? LUNIX_TAP_CRC_OK : 0,
+	              packet, min(len, LUNIX_TAP_MAX_DATA));
+}
+
+/*
+ * Returns true if a whole record is queued, and its header in `rec'.
+ * The producer may have queued the header but not yet the data.
+ */
+static int lunix_tap_ready(struct lunix_tap_struct *tap, struct lunix_tap_record *rec)
+{
+	unsigned int len = kfifo_len(&tap->fifo);
+
+	if (len < sizeof(*rec))
+		return 0;
+	kfifo_out_peek(&tap->fifo, (unsigned char *)rec, sizeof(*rec));
+	return len >= sizeof(*rec) + rec->len;
+}
+
+static int lunix_tap_open(struct inode *inode, struct file *filp)
+{
+	struct lunix_tap_struct *tap = container_of(filp->private_data,
+	                                            struct lunix_tap_struct, misc);
+	int ret;
+
+	if ((ret = nonseekable_open(inode, filp)) < 0)
+		return ret;
+
+	/* A single reader at a time, which gets to see everything */
+	if (!atomic_add_unless(&tap->available, -1, 0))
+		return -EBUSY;
+
+	/* Producers may still be finishing records, from before the last close */
+	spin_lock(&tap->lock);
+	kfifo_reset(&tap->fifo);
+	tap->lost = 0;
+	spin_unlock(&tap->lock);
+
+	static_branch_enable(tap->key);
+	debug("tap %s opened\n", tap->misc.name);
+	return 0;
+}
+
+static int lunix_tap_release(struct inode *inode, struct file *filp)
+{
+	struct lunix_tap_struct *tap = container_of(filp->private_data,
+	                                            struct lunix_tap_struct, misc);
+
+	static_branch_disable(tap->key);
+	atomic_inc(&tap->available);
+	debug("tap %s released\n", tap->misc.name);
+	return 0;
+}
+
+/*
+ * Returns as many whole records as fit in the buffer, blocking until
+ * there is at least one. A buffer of sizeof(struct lunix_tap_record)
+ * + LUNIX_TAP_MAX_DATA bytes always fits the next record.
+ */
+static ssize_t lunix_tap_read(struct file *filp, char __user *usrbuf, size_t cnt, loff_t *f_pos)
+{
+	struct lunix_tap_struct *tap = container_of(filp->private_data,
+	                                            struct lunix_tap_struct, misc);
+	struct lunix_tap_record rec;
+	unsigned int copied;
+	size_t need;
+	ssize_t ret = 0;
+
+	if (mutex_lock_interruptible(&tap->read_lock))
+		return -ERESTARTSYS;
+
+	while (!lunix_tap_ready(tap, &rec)) {
+		mutex_unlock(&tap->read_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(tap->wq, lunix_tap_ready(tap, &rec)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&tap->read_lock))
+			return -ERESTARTSYS;
+	}
+
+	do {
+		need = sizeof(rec) + rec.len;
+		if (ret + need > cnt)
+			break;
+		if (kfifo_to_user(&tap->fifo, usrbuf + ret, need, &copied) < 0) {
+			/* A record was cut short, the rest of the FIFO is lost */
+			kfifo_reset_out(&tap->fifo);
+			ret = -EFAULT;
+			goto out;
+		}
+		ret += need;
+	} while (lunix_tap_ready(tap, &rec));
+
+	if (!ret)
+		ret = -EINVAL;
+out:
+	mutex_unlock(&tap->read_lock);
+	return ret;
+}
+
+static __poll_t lunix_tap_poll(struct file *filp, poll_table *wait)
+{
+	struct lunix_tap_struct *tap = container_of(filp->private_data,
+	                                            struct lunix_tap_struct, misc);
+	struct lunix_tap_record rec;
+
+	poll_wait(filp, &tap->wq, wait);
+	return lunix_tap_ready(tap, &rec) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static const struct file_operations lunix_tap_fops = {
+	.owner   = THIS_MODULE,
+	.open    = lunix_tap_open,
+	.release = lunix_tap_release,
+	.read    = lunix_tap_read,
+	.poll    = lunix_tap_poll,
+};
+
+static int lunix_tap_setup(struct lunix_tap_struct *tap, const char *name,
+                           struct static_key_false *key)
+{
+	int ret;
+
+	if ((ret = kfifo_alloc(&tap->fifo, lunix_tap_size * 1024, GFP_KERNEL)) < 0)
+		return ret;
+
+	spin_lock_init(&tap->lock);
+	mutex_init(&tap->read_lock);
+	init_waitqueue_head(&tap->wq);
+	atomic_set(&tap->available, 1);
+	tap->key = key;
+
+	tap->misc.minor = MISC_DYNAMIC_MINOR;
+	tap->misc.name = name;
+	tap->misc.fops = &lunix_tap_fops;
+	tap->misc.mode = 0600;
+
+	if ((ret = misc_register(&tap->misc)) < 0)
+		kfifo_free(&tap->fifo);
+	return ret;
+}
+
+static void lunix_tap_teardown(struct lunix_tap_struct *tap)
+{
+	misc_deregister(&tap->misc);
+	kfifo_free(&tap->fifo);
+}
+
+int lunix_tap_init(void)
+{
+	int ret;
+
+	debug("initializing traffic taps\n");
+	if (!lunix_tap_size)
+		return -EINVAL;
+
+	if ((ret = lunix_tap_setup(lunix_tap_raw_dev, LUNIX_TAP_RAW_NAME, &lunix_tap_raw_key)) < 0)
+		goto out;
+	if ((ret = lunix_tap_setup(lunix_tap_frame_dev, LUNIX_TAP_FRAME_NAME, &lunix_tap_frame_key)) < 0)
+		goto out_with_raw;
+
+	return 0;
+
+out_with_raw:
+	lunix_tap_teardown(lunix_tap_raw_dev);
+out:
+	printk(KERN_ERR "%s: Error registering traffic taps, ret = %d.\n", __FILE__, ret);
+	return ret;
+}
+
+void lunix_tap_destroy(void)
+{
+	debug("removing traffic taps\n");
+	lunix_tap_teardown(lunix_tap_frame_dev);
+	lunix_tap_teardown(lunix_tap_raw_dev);
+}
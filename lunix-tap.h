@@ -0,0 +1,99 @@
+/*
+ * lunix-tap.h
+ *
+ * Definition file for the traffic taps of Lunix:TNG,
+ * shared with the userspace capture and replay tools.
+ */
+
+#ifndef _LUNIX_TAP_H
+#define _LUNIX_TAP_H
+
+/*
+ * Device nodes: the raw bytes received from the TTY, and the
+ * frames decoded from them, of any AM type, unescaped.
+ */
+#define LUNIX_TAP_RAW_NAME   "lunix-tap-raw"
+#define LUNIX_TAP_FRAME_NAME "lunix-tap-frames"
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/jump_label.h>
+
+/*
+ * The taps cost a patched-out branch while nobody has them open
+ */
+DECLARE_STATIC_KEY_FALSE(lunix_tap_raw_key);
+DECLARE_STATIC_KEY_FALSE(lunix_tap_frame_key);
+
+void __lunix_tap_raw(const unsigned char *buf, int count);
+void __lunix_tap_frame(const unsigned char *packet, int len, int crc_ok);
+
+static inline void lunix_tap_raw(const unsigned char *buf, int count)
+{
+	if (static_branch_unlikely(&lunix_tap_raw_key))
+		__lunix_tap_raw(buf, count);
+}
+
+static inline void lunix_tap_frame(const unsigned char *packet, int len, int crc_ok)
+{
+	if (static_branch_unlikely(&lunix_tap_frame_key))
+		__lunix_tap_frame(packet, len, crc_ok);
+}
+
+/*
+ * Function prototypes
+ */
+int lunix_tap_init(void);
+void lunix_tap_destroy(void);
+
+#else
+#include <inttypes.h>
+#endif /* __KERNEL__ */
+
+/*
+ * Both taps return a stream of records, each a header followed by
+ * `len` bytes of data. A read returns whole records only, as many as
+ * fit. Records that do not fit in the tap's buffer are dropped rather
+ * than slowing down the receive path; `lost` counts those dropped
+ * since the previous record.
+ */
+#define LUNIX_TAP_RAW      1    /* A batch of bytes, as received from the TTY */
+#define LUNIX_TAP_FRAME    2    /* A complete frame, from start to end byte */
+
+#define LUNIX_TAP_CRC_OK   0x01 /* Frame flag: the CRC checked out */
+
+#define LUNIX_TAP_MAX_DATA 4096 /* Longer raw batches are split */
+
+struct lunix_tap_record {
+	uint64_t ts_ns;         /* Time received, CLOCK_REALTIME */
+	uint32_t lost;
+	uint16_t len;
+	uint8_t type;
+	uint8_t flags;
+	unsigned char data[];
+};
+
+/*
+ * Capture files, as written by lunix-capture and replayed by
+ * lunix-replay: a header, then records as above, only with the
+ * time since the previous record instead of a timestamp. Drops
+ * are kept in records of their own, holding the 32-bit count.
+ */
+#define LUNIX_CAP_MAGIC    "LUNIXCAP"
+#define LUNIX_TAP_LOST     3
+
+struct lunix_cap_header {
+	char magic[8];
+	uint64_t start_ns;      /* Timestamp of the first record */
+};
+
+struct lunix_cap_record {
+	int32_t delta_us;       /* Taps are not ordered with each other */
+	uint16_t len;
+	uint8_t type;
+	uint8_t flags;
+	unsigned char data[];
+};
+
+#endif /* _LUNIX_TAP_H */
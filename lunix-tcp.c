@@ -0,0 +1,300 @@
+/*
+ * lunix-tcp.c
+ *
+ * In-kernel TCP ingest for Lunix:TNG: a kernel thread connects to
+ * the base station's TCP endpoint and passes what it receives to a
+ * protocol parser of its own, without socat, a pty or the line
+ * discipline in between. It reconnects, with backoff, when the
+ * connection fails or drops.
+ */
+
+#include <linux/net.h>
+#include <linux/tcp.h>
+#include <linux/inet.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/sched/signal.h>
+#include <net/sock.h>
+#include <net/tcp.h>
+
+#include "lunix.h"
+#include "lunix-tcp.h"
+#include "lunix-protocol.h"
+#include "lunix-stats.h"
+#include "lunix-tap.h"
+
+#define LUNIX_TCP_ENDPOINT_LEN 64
+
+/*
+ * The endpoint, and the thread ingesting from it
+ */
+static DEFINE_MUTEX(lunix_tcp_mutex);   /* Serializes starting and stopping the thread */
+static struct {
+	char endpoint[LUNIX_TCP_ENDPOINT_LEN];
+	struct sockaddr_storage addr;
+	struct task_struct *task;
+	bool stopping;                  /* The thread is about to be sent a SIGKILL */
+	bool ready;                     /* The rest of the module is up */
+} lunix_tcp;
+
+/*
+ * Parses "address:port", or "[address]:port" for IPv6. There is no
+ * name resolution in the kernel, so the address has to be numeric.
+ * An empty string disables the ingest.
+ */
+static int lunix_tcp_parse(const char *val, char *endpoint, struct sockaddr_storage *addr)
+{
+	char buf[LUNIX_TCP_ENDPOINT_LEN], *host, *port;
+	size_t len;
+
+	if (strscpy(buf, val, sizeof(buf)) < 0)
+		return -EINVAL;
+	host = strim(buf);
+	strscpy(endpoint, host, LUNIX_TCP_ENDPOINT_LEN);
+	if (!*host)
+		return 0;
+
+	port = strrchr(host, ':');
+	if (!port)
+		return -EINVAL;
+	*port++ = '\0';
+
+	len = strlen(host);
+	if (len >= 2 && host[0] == '[' && host[len - 1] == ']') {
+		host[len - 1] = '\0';
+		host++;
+	}
+
+	return inet_pton_with_scope(&init_net, AF_UNSPEC, host, port, addr);
+}
+
+/*
+ * Connects to the endpoint. Returns 0 and the socket, or -errno.
+ */
+static int lunix_tcp_connect(struct socket **sockp)
+{
+	struct sockaddr_storage *addr = &lunix_tcp.addr;
+	struct socket *sock;
+	int ret;
+
+	ret = sock_create_kern(&init_net, addr->ss_family, SOCK_STREAM, IPPROTO_TCP, &sock);
+	if (ret < 0)
+		return ret;
+
+	/* connect() waits for up to the send timeout */
+	sock->sk->sk_sndtimeo = LUNIX_TCP_CONNECT_TIMEOUT;
+
+	/* Notice a base station gone silent, not only one that hung up */
+	sock_set_keepalive(sock->sk);
+	tcp_sock_set_keepidle(sock->sk, 10);
+	tcp_sock_set_keepintvl(sock->sk, 5);
+	tcp_sock_set_keepcnt(sock->sk, 3);
+
+	ret = kernel_connect(sock, (struct sockaddr *)addr, sizeof(*addr), 0);
+	if (ret < 0) {
+		sock_release(sock);
+		return ret;
+	}
+
+	*sockp = sock;
+	return 0;
+}
+
+/*
+ * Passes everything received on a connection to the parser, until
+ * it drops. Every call returns whatever has been queued, up to
+ * LUNIX_TCP_BUFSZ bytes, so a backlog of segments is drained and
+ * parsed in one batch, with a single wakeup of the readers.
+ */
+static int lunix_tcp_receive(struct socket *sock, struct lunix_protocol_state_struct *proto,
+                             unsigned char *buf)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int n;
+
+	while (!READ_ONCE(lunix_tcp.stopping)) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = LUNIX_TCP_BUFSZ;
+
+		n = kernel_recvmsg(sock, &msg, &iov, 1, LUNIX_TCP_BUFSZ, 0);
+		if (n <= 0)
+			return n ? n : -ECONNRESET;
+
+		lunix_stat_add(LUNIX_STAT_TCP_BYTES, n);
+		lunix_tap_raw(buf, n);
+
+		proto->rx_time = lunix_latency_now();
+		lunix_protocol_received_buf(proto, buf, n);
+		lunix_sensor_wake_flush();
+	}
+
+	return 0;
+}
+
+/*
+ * Waits for kthread_stop(), so that a thread which is done early
+ * does not exit under the feet of the code stopping it.
+ */
+static void lunix_tcp_park(void)
+{
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int lunix_tcp_thread(void *unused)
+{
+	struct lunix_protocol_state_struct *proto;
+	unsigned int backoff = LUNIX_TCP_BACKOFF_MIN_MS;
+	struct socket *sock;
+	unsigned char *buf;
+	int ret;
+
+	/*
+	 * Either the SIGKILL is sent after this, and interrupts
+	 * connecting, receiving or backing off, or `stopping`
+	 * is already visible below.
+	 */
+	allow_signal(SIGKILL);
+	smp_mb();
+
+	buf = kmalloc(LUNIX_TCP_BUFSZ, GFP_KERNEL);
+	proto = kmalloc(sizeof(*proto), GFP_KERNEL);
+	if (!buf || !proto) {
+		printk(KERN_ERR "lunix: out of memory for TCP ingest\n");
+		goto out;
+	}
+
+	while (!READ_ONCE(lunix_tcp.stopping)) {
+		ret = lunix_tcp_connect(&sock);
+		if (!ret) {
+			printk(KERN_INFO "lunix: connected to %pISpc\n", &lunix_tcp.addr);
+			lunix_stat_inc(LUNIX_STAT_TCP_CONNECTS);
+			backoff = LUNIX_TCP_BACKOFF_MIN_MS;
+
+			/* A new connection starts mid-stream */
+			lunix_protocol_init(proto);
+			lunix_sensor_feed_attach();
+			ret = lunix_tcp_receive(sock, proto, buf);
+			lunix_sensor_feed_detach();
+			sock_release(sock);
+		}
+		if (READ_ONCE(lunix_tcp.stopping))
+			break;
+
+		printk_ratelimited(KERN_WARNING "lunix: connection to %pISpc failed or lost (%d), "
+		                   "retrying in %u ms\n", &lunix_tcp.addr, ret, backoff);
+		schedule_timeout_interruptible(msecs_to_jiffies(backoff));
+		backoff = min_t(unsigned int, backoff * 2, LUNIX_TCP_BACKOFF_MAX_MS);
+	}
+
+out:
+	kfree(proto);
+	kfree(buf);
+	flush_signals(current);
+	lunix_tcp_park();
+	return 0;
+}
+
+static int lunix_tcp_start(void)
+{
+	struct task_struct *task;
+
+	lunix_tcp.stopping = false;
+	task = kthread_run(lunix_tcp_thread, NULL, "lunix-tcp");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	lunix_tcp.task = task;
+	return 0;
+}
+
+static void lunix_tcp_stop(void)
+{
+	if (!lunix_tcp.task)
+		return;
+
+	/* The thread may be blocked in the network stack, which only a signal interrupts */
+	WRITE_ONCE(lunix_tcp.stopping, true);
+	smp_mb();
+	send_sig(SIGKILL, lunix_tcp.task, 1);
+	kthread_stop(lunix_tcp.task);
+	lunix_tcp.task = NULL;
+}
+
+/*
+ * The lunix_tcp module parameter: setting it, at load time or later
+ * through sysfs, (re)starts the ingest; setting it empty stops it.
+ */
+static int lunix_tcp_param_set(const char *val, const struct kernel_param *kp)
+{
+	char endpoint[LUNIX_TCP_ENDPOINT_LEN];
+	struct sockaddr_storage addr = { };
+	int ret;
+
+	if ((ret = lunix_tcp_parse(val, endpoint, &addr)) < 0)
+		return ret;
+
+	mutex_lock(&lunix_tcp_mutex);
+	if (lunix_tcp.ready)
+		lunix_tcp_stop();
+	strscpy(lunix_tcp.endpoint, endpoint, sizeof(lunix_tcp.endpoint));
+	lunix_tcp.addr = addr;
+	if (lunix_tcp.ready && *endpoint)
+		ret = lunix_tcp_start();
+	mutex_unlock(&lunix_tcp_mutex);
+
+	return ret;
+}
+
+static int lunix_tcp_param_get(char *buf, const struct kernel_param *kp)
+{
+	int ret;
+
+	mutex_lock(&lunix_tcp_mutex);
+	ret = sysfs_emit(buf, "%s\n", lunix_tcp.endpoint);
+	mutex_unlock(&lunix_tcp_mutex);
+
+	return ret;
+}
+
+static const struct kernel_param_ops lunix_tcp_param_ops = {
+	.set = lunix_tcp_param_set,
+	.get = lunix_tcp_param_get,
+};
+module_param_cb(lunix_tcp, &lunix_tcp_param_ops, NULL, 0644);
+MODULE_PARM_DESC(lunix_tcp, "Base station TCP endpoint to ingest from, as address:port (default: none)");
+
+int lunix_tcp_init(void)
+{
+	int ret = 0;
+
+	debug("initializing TCP ingest\n");
+	mutex_lock(&lunix_tcp_mutex);
+	lunix_tcp.ready = true;
+	if (*lunix_tcp.endpoint && (ret = lunix_tcp_start()) < 0) {
+		printk(KERN_ERR "%s: Error starting TCP ingest, ret = %d.\n", __FILE__, ret);
+		lunix_tcp.ready = false;
+	}
+	mutex_unlock(&lunix_tcp_mutex);
+
+	return ret;
+}
+
+void lunix_tcp_destroy(void)
+{
+	debug("stopping TCP ingest\n");
+	mutex_lock(&lunix_tcp_mutex);
+	lunix_tcp_stop();
+	lunix_tcp.ready = false;
+	mutex_unlock(&lunix_tcp_mutex);
+}
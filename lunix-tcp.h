@@ -0,0 +1,29 @@
+/*
+ * lunix-tcp.h
+ *
+ * Definition file for the in-kernel
+ * TCP ingest of Lunix:TNG
+ */
+
+#ifndef _LUNIX_TCP_H
+#define _LUNIX_TCP_H
+
+#ifdef __KERNEL__
+
+/*
+ * Receive buffer, and reconnection backoff bounds
+ */
+#define LUNIX_TCP_BUFSZ          16384
+#define LUNIX_TCP_BACKOFF_MIN_MS 100
+#define LUNIX_TCP_BACKOFF_MAX_MS 30000
+#define LUNIX_TCP_CONNECT_TIMEOUT (5 * HZ)
+
+/*
+ * Function prototypes
+ */
+int lunix_tcp_init(void);
+void lunix_tcp_destroy(void);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LUNIX_TCP_H */
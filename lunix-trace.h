@@ -0,0 +1,166 @@
+/*
+ * lunix-trace.h
+ *
+ * Tracepoints for Lunix:TNG, covering every stage
+ * a measurement goes through, from the TTY to userspace.
+ *
+ * Enable them with e.g.
+ *   echo 1 > /sys/kernel/tracing/events/lunix/enable
+ * or use them with perf (perf record -e 'lunix:*').
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lunix
+
+#if !defined(_LUNIX_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LUNIX_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Maximum number of received bytes recorded per batch
+ */
+#define LUNIX_TRACE_DUMP 32
+
+TRACE_EVENT(lunix_ldisc_receive,
+	TP_PROTO(const unsigned char *cp, int count),
+	TP_ARGS(cp, count),
+	TP_STRUCT__entry(
+		__field(int, count)
+		__dynamic_array(unsigned char, data, min(count, LUNIX_TRACE_DUMP))
+	),
+	TP_fast_assign(
+		__entry->count = count;
+		memcpy(__get_dynamic_array(data), cp, min(count, LUNIX_TRACE_DUMP));
+	),
+	TP_printk("count=%d data=%s", __entry->count,
+	          __print_hex(__get_dynamic_array(data), __get_dynamic_array_len(data)))
+);
+
+TRACE_EVENT(lunix_frame_start,
+	TP_PROTO(int offset, int count),
+	TP_ARGS(offset, count),
+	TP_STRUCT__entry(
+		__field(int, offset)
+		__field(int, count)
+	),
+	TP_fast_assign(
+		__entry->offset = offset;
+		__entry->count = count;
+	),
+	TP_printk("offset=%d/%d", __entry->offset, __entry->count)
+);
+
+TRACE_EVENT(lunix_frame_complete,
+	TP_PROTO(unsigned char am_type, unsigned char payload_length, int crc_ok),
+	TP_ARGS(am_type, payload_length, crc_ok),
+	TP_STRUCT__entry(
+		__field(unsigned char, am_type)
+		__field(unsigned char, payload_length)
+		__field(int, crc_ok)
+	),
+	TP_fast_assign(
+		__entry->am_type = am_type;
+		__entry->payload_length = payload_length;
+		__entry->crc_ok = crc_ok;
+	),
+	TP_printk("am_type=0x%02x payload_length=%u crc=%s", __entry->am_type,
+	          __entry->payload_length, __entry->crc_ok ? "ok" : "bad")
+);
+
+TRACE_EVENT(lunix_failover,
+	TP_PROTO(int standby),
+	TP_ARGS(standby),
+	TP_STRUCT__entry(
+		__field(int, standby)
+	),
+	TP_fast_assign(
+		__entry->standby = standby;
+	),
+	TP_printk("publishing=%s", __entry->standby ? "standby" : "primary")
+);
+
+TRACE_EVENT(lunix_sensor_update,
+	TP_PROTO(int sensor_num, uint16_t batt, uint16_t temp, uint16_t light),
+	TP_ARGS(sensor_num, batt, temp, light),
+	TP_STRUCT__entry(
+		__field(int, sensor_num)
+		__field(uint16_t, batt)
+		__field(uint16_t, temp)
+		__field(uint16_t, light)
+	),
+	TP_fast_assign(
+		__entry->sensor_num = sensor_num;
+		__entry->batt = batt;
+		__entry->temp = temp;
+		__entry->light = light;
+	),
+	TP_printk("sensor=%d batt=0x%04x temp=0x%04x light=0x%04x", __entry->sensor_num,
+	          __entry->batt, __entry->temp, __entry->light)
+);
+
+TRACE_EVENT(lunix_sensor_wake,
+	TP_PROTO(int sensor_num),
+	TP_ARGS(sensor_num),
+	TP_STRUCT__entry(
+		__field(int, sensor_num)
+	),
+	TP_fast_assign(
+		__entry->sensor_num = sensor_num;
+	),
+	TP_printk("sensor=%d", __entry->sensor_num)
+);
+
+TRACE_EVENT(lunix_sensor_stale,
+	TP_PROTO(int sensor_num),
+	TP_ARGS(sensor_num),
+	TP_STRUCT__entry(
+		__field(int, sensor_num)
+	),
+	TP_fast_assign(
+		__entry->sensor_num = sensor_num;
+	),
+	TP_printk("sensor=%d", __entry->sensor_num)
+);
+
+TRACE_EVENT(lunix_reader_wake,
+	TP_PROTO(int sensor_num, int type),
+	TP_ARGS(sensor_num, type),
+	TP_STRUCT__entry(
+		__field(int, sensor_num)
+		__field(int, type)
+	),
+	TP_fast_assign(
+		__entry->sensor_num = sensor_num;
+		__entry->type = type;
+	),
+	TP_printk("sensor=%d type=%d", __entry->sensor_num, __entry->type)
+);
+
+TRACE_EVENT(lunix_chrdev_read,
+	TP_PROTO(int sensor_num, int type, uint32_t seq, size_t cnt),
+	TP_ARGS(sensor_num, type, seq, cnt),
+	TP_STRUCT__entry(
+		__field(int, sensor_num)
+		__field(int, type)
+		__field(uint32_t, seq)
+		__field(size_t, cnt)
+	),
+	TP_fast_assign(
+		__entry->sensor_num = sensor_num;
+		__entry->type = type;
+		__entry->seq = seq;
+		__entry->cnt = cnt;
+	),
+	TP_printk("sensor=%d type=%d seq=%u cnt=%zu", __entry->sensor_num,
+	          __entry->type, __entry->seq, __entry->cnt)
+);
+
+#endif /* _LUNIX_TRACE_H */
+
+/* This part must be outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lunix-trace
+#include <trace/define_trace.h>
@@ -0,0 +1,169 @@
+/*
+ * lunix-xmesh.h
+ *
+ * Helpers to build XMesh packets, as sent by the base station,
+ * for the simulator, the benchmarks and the self-test module,
+ * and the command packets sent down to the nodes by the driver.
+ * See lunix-protocol.c for the packet structure.
+ */
+
+#ifndef _LUNIX_XMESH_H
+#define _LUNIX_XMESH_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define XMESH_SYNC_BYTE       0x7E
+#define XMESH_ESCAPE_BYTE     0x7D
+#define XMESH_P_PACKET_NO_ACK 0x42
+#define XMESH_UART_ADDR       0x007E
+#define XMESH_DEFAULT_GROUP   0x7D
+#define XMESH_AM_SENSOR       0x0B
+#define XMESH_AM_XCOMMAND     0x30
+
+/*
+ * Sensor packet payload: multihop header, then the sensor board data.
+ * The offsets match those used by lunix-protocol.c for the whole packet.
+ */
+#define XMESH_PAYLOAD_OFFSET  7
+#define XMESH_SENSOR_PL       22
+#define XMESH_ORIGIN_OFFSET   9
+#define XMESH_SEQNO_OFFSET    11
+#define XMESH_VREF_OFFSET     18
+#define XMESH_TEMP_OFFSET     20
+#define XMESH_LIGHT_OFFSET    22
+
+/*
+ * XCommand packet payload, sent down to a node: a command sequence
+ * number, the destination node, then the command and its argument.
+ */
+#define XMESH_XCOMMAND_PL     10
+#define XMESH_XCMD_SEQNO_OFFSET  7
+#define XMESH_XCMD_DEST_OFFSET   9
+#define XMESH_XCMD_CMD_OFFSET    11
+#define XMESH_XCMD_ARG_OFFSET    13
+
+/*
+ * Raw size of a packet with a payload of `pl' bytes: header, payload,
+ * CRC and end byte. On the wire, worst case, every byte but the three
+ * unescaped ones doubles.
+ */
+#define XMESH_RAW_LEN(pl)     (XMESH_PAYLOAD_OFFSET + (pl) + 3)
+#define XMESH_WIRE_LEN(pl)    (2 * XMESH_RAW_LEN(pl))
+#define XMESH_MAX_RAW         XMESH_RAW_LEN(255)
+#define XMESH_MAX_WIRE        XMESH_WIRE_LEN(255)
+
+/*
+ * CRC-16/CCITT, polynomial 0x1021, initial value 0,
+ * as computed by the TinyOS serial framer.
+ */
+static inline uint16_t xmesh_crc(const uint8_t *p, size_t len)
+{
+	uint16_t crc = 0;
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+static inline void xmesh_put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static inline void xmesh_put32(uint8_t *p, uint32_t v)
+{
+	xmesh_put16(&p[0], v & 0xFFFF);
+	xmesh_put16(&p[2], v >> 16);
+}
+
+/*
+ * Frames a raw packet: fills in its CRC and end byte, and escapes
+ * everything from the destination address to the CRC into `wire'.
+ * `raw' must hold the start byte, packet type, header and payload.
+ * Returns the number of bytes written to `wire'.
+ */
+static inline size_t xmesh_frame(uint8_t *wire, uint8_t *raw)
+{
+	size_t len = XMESH_PAYLOAD_OFFSET + raw[6];
+	size_t i, n = 0;
+
+	xmesh_put16(&raw[len], xmesh_crc(&raw[1], len - 1));
+	raw[len + 2] = XMESH_SYNC_BYTE;
+
+	wire[n++] = raw[0];
+	wire[n++] = raw[1];
+	for (i = 2; i < len + 2; i++) {
+		if (raw[i] == XMESH_SYNC_BYTE || raw[i] == XMESH_ESCAPE_BYTE) {
+			wire[n++] = XMESH_ESCAPE_BYTE;
+			wire[n++] = raw[i] ^ 0x20;
+		} else {
+			wire[n++] = raw[i];
+		}
+	}
+	wire[n++] = raw[len + 2];
+
+	return n;
+}
+
+/*
+ * Builds a complete sensor packet from node `node' into `wire'.
+ * Returns the number of bytes written.
+ */
+static inline size_t xmesh_sensor_packet(uint8_t *wire, uint16_t node, uint16_t seqno,
+                                         uint16_t batt, uint16_t temp, uint16_t light)
+{
+	uint8_t raw[XMESH_RAW_LEN(XMESH_SENSOR_PL)] = { 0 };
+
+	raw[0] = XMESH_SYNC_BYTE;
+	raw[1] = XMESH_P_PACKET_NO_ACK;
+	xmesh_put16(&raw[2], XMESH_UART_ADDR);
+	raw[4] = XMESH_AM_SENSOR;
+	raw[5] = XMESH_DEFAULT_GROUP;
+	raw[6] = XMESH_SENSOR_PL;
+	xmesh_put16(&raw[XMESH_PAYLOAD_OFFSET], node);
+	xmesh_put16(&raw[XMESH_ORIGIN_OFFSET], node);
+	xmesh_put16(&raw[XMESH_SEQNO_OFFSET], seqno);
+	xmesh_put16(&raw[XMESH_VREF_OFFSET], batt);
+	xmesh_put16(&raw[XMESH_TEMP_OFFSET], temp);
+	xmesh_put16(&raw[XMESH_LIGHT_OFFSET], light);
+
+	return xmesh_frame(wire, raw);
+}
+
+/*
+ * Builds a complete XCommand packet to node `node' into `wire', which
+ * must hold XMESH_WIRE_LEN(XMESH_XCOMMAND_PL) bytes, e.g.
+ * XCOMMAND_SET_RATE with the new sampling period in ms.
+ * Returns the number of bytes written.
+ */
+static inline size_t xmesh_xcommand_packet(uint8_t *wire, uint16_t node, uint16_t seqno,
+                                           uint16_t cmd, uint32_t arg)
+{
+	uint8_t raw[XMESH_RAW_LEN(XMESH_XCOMMAND_PL)] = { 0 };
+
+	raw[0] = XMESH_SYNC_BYTE;
+	raw[1] = XMESH_P_PACKET_NO_ACK;
+	xmesh_put16(&raw[2], node);
+	raw[4] = XMESH_AM_XCOMMAND;
+	raw[5] = XMESH_DEFAULT_GROUP;
+	raw[6] = XMESH_XCOMMAND_PL;
+	xmesh_put16(&raw[XMESH_XCMD_SEQNO_OFFSET], seqno);
+	xmesh_put16(&raw[XMESH_XCMD_DEST_OFFSET], node);
+	xmesh_put16(&raw[XMESH_XCMD_CMD_OFFSET], cmd);
+	xmesh_put32(&raw[XMESH_XCMD_ARG_OFFSET], arg);
+
+	return xmesh_frame(wire, raw);
+}
+
+#endif /* _LUNIX_XMESH_H */
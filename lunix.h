@@ -24,7 +24,35 @@
 
 #define LUNIX_MSR_MAGIC 0xF00DF00D
 
+/*
+ * Number of recent samples kept per measurement (a power of two)
+ */
+#define LUNIX_SENSOR_HIST 64
+
+/*
+ * Number of recent packets per node remembered to drop
+ * the copies of a packet that took several routes
+ */
+#define LUNIX_DEDUP_WINDOW 8
+
 enum lunix_msr_enum { BATT = 0, TEMP, LIGHT, N_LUNIX_MSR };
+
+/*
+ * Liveness of a node: not heard from since the module was loaded,
+ * heard from recently, or silent for longer than the stale timeout
+ */
+enum lunix_node_enum { LUNIX_NODE_UNSEEN = 0, LUNIX_NODE_LIVE, LUNIX_NODE_STALE };
+
+/*
+ * State of the feeds, i.e. the TTYs, feed device files and TCP
+ * connections data arrive from: none attached since the module was
+ * loaded, at least one attached, or all of them detached again
+ */
+enum lunix_feed_enum { LUNIX_FEED_NONE = 0, LUNIX_FEED_UP, LUNIX_FEED_DOWN };
+
+struct lunix_agg_struct;
+struct lunix_sketch;
+
 struct lunix_sensor_struct {
 	/*
 	 * A number of pages, one for each measurement.
@@ -32,6 +60,66 @@ struct lunix_sensor_struct {
 	 */
 	struct lunix_msr_data_struct *msr_data[N_LUNIX_MSR];
 
+	/*
+	 * Number of updates published so far, per measurement.
+	 * It lets readers tell how many samples they skipped.
+	 */
+	uint32_t msr_seq[N_LUNIX_MSR];
+
+	/*
+	 * Number of samples received so far, published or not, and
+	 * running sum of their values in thousandths of the unit, as
+	 * converted by the lookup tables, for readers that average.
+	 */
+	uint32_t msr_cnt[N_LUNIX_MSR];
+	s64 msr_sum[N_LUNIX_MSR];
+
+	/*
+	 * The most recent raw values of each measurement, indexed
+	 * by sequence number, and the time (in jiffies) they arrived.
+	 * Readers batching their wakeups collect their samples here.
+	 */
+	uint16_t msr_hist[N_LUNIX_MSR][LUNIX_SENSOR_HIST];
+	unsigned long msr_hist_jiffies[N_LUNIX_MSR][LUNIX_SENSOR_HIST];
+
+	/*
+	 * Latency accounting, while enabled: when the first byte of the
+	 * last packet was received, when the sensor was updated from it,
+	 * and when its sleepers were last woken up.
+	 */
+	ktime_t rx_time;
+	ktime_t publish_time;
+	ktime_t wake_time;
+
+	/*
+	 * The keys (sequence number and measurements) of the last
+	 * packets received from the node, `dedup_cnt' of them valid,
+	 * the oldest overwritten next at `dedup_next'.
+	 */
+	uint64_t dedup_key[LUNIX_DEDUP_WINDOW];
+	unsigned int dedup_cnt;
+	unsigned int dedup_next;
+
+	/*
+	 * Liveness tracking: when (in jiffies) the node was last heard
+	 * from, whether it has gone stale, and how many times it did.
+	 */
+	unsigned long last_seen;
+	enum lunix_node_enum node_state;
+	uint32_t stale_cnt;
+
+	/*
+	 * Sliding-window aggregates of every measurement,
+	 * see lunix-agg.h
+	 */
+	struct lunix_agg_struct *agg;
+
+	/*
+	 * Quantile sketches of every measurement,
+	 * see lunix-sketch.h
+	 */
+	struct lunix_sketch *sketch;
+
 	/*
 	 * Spinlock used to assert mutual exclusion between
 	 * the serial line discipline and the character device driver
@@ -51,7 +139,12 @@ struct lunix_sensor_struct {
 #define LUNIX_SENSOR_CNT 16
 extern int lunix_sensor_cnt;
 extern struct lunix_sensor_struct *lunix_sensors;
-extern struct lunix_protocol_state_struct lunix_protocol_state;
+
+/*
+ * The state of the feeds, and the number of times they went down
+ */
+extern enum lunix_feed_enum lunix_sensors_feed_state;
+extern uint32_t lunix_sensors_feed_downs;
 
 /*
  * Debugging
@@ -68,22 +161,69 @@ extern struct lunix_protocol_state_struct lunix_protocol_state;
 int lunix_sensor_init(struct lunix_sensor_struct *);
 void lunix_sensor_destroy(struct lunix_sensor_struct *);
 void lunix_sensor_update(struct lunix_sensor_struct *s,
-                         uint16_t batt, uint16_t temp, uint16_t light);
+                         uint16_t batt, uint16_t temp, uint16_t light,
+                         ktime_t rx_time);
+int lunix_sensor_wake_init(void);
+void lunix_sensor_wake_destroy(void);
+void lunix_sensor_wake_flush(void);
+void lunix_sensor_feed_attach(void);
+void lunix_sensor_feed_detach(void);
 
 #else
 #include <inttypes.h>
 #endif /* __KERNEL__ */
 /*
  * A structure, living at the start of a page, containing a version number
- * [timestamp of last update] and a variable number of 32-bit quantities. It is
- * meant to be mappable to userspace.
+ * [timestamp of last update], flags and a variable number of 32-bit
+ * quantities. It is meant to be mappable to userspace.
  */
 struct lunix_msr_data_struct {
 	uint32_t magic;
 	uint32_t last_update;
+	uint32_t flags;
 	uint32_t values[];
 };
 
+/*
+ * Flags of a measurement page: the node has not been heard
+ * from for longer than the stale timeout, and the values
+ * are those it last sent.
+ */
+#define LUNIX_MSR_STALE 0x1
+
+/*
+ * The maximum number of aggregation windows, and the aggregates of a
+ * measurement over one of them: the number of samples received in it,
+ * and their minimum, maximum, mean and standard deviation, in
+ * thousandths of the measurement unit. All zero for an empty window.
+ */
+#define LUNIX_AGG_WINDOWS 4
+
+struct lunix_agg_window {
+	uint32_t window_s;      /* Length of the window, 0 for an unused slot */
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	uint32_t stddev;
+};
+
+/*
+ * A page holding the aggregates of a measurement over every window,
+ * as of the last update [timestamp]. It is meant to be mappable to
+ * userspace; `seq` is odd while the page is being updated, and readers
+ * retry until they see the same even value before and after copying it.
+ */
+#define LUNIX_AGG_MAGIC 0xA99DA7A5
+
+struct lunix_agg_data_struct {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t last_update;
+	uint32_t nr_windows;
+	struct lunix_agg_window windows[LUNIX_AGG_WINDOWS];
+};
+
 /*
  * Lunix:TNG line discipline number:
  * Hijack the "Mobitex module" line discipline, since the number
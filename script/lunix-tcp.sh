@@ -1,6 +1,8 @@
 #!/bin/bash
 
-TCP_ENDPOINT=lunix.cslab.ece.ntua.gr:49152
+# Override with e.g. LUNIX_TCP_ENDPOINT=localhost:49152,
+# to connect to a local ./lunix-sim -l 49152 instead
+TCP_ENDPOINT=${LUNIX_TCP_ENDPOINT:-lunix.cslab.ece.ntua.gr:49152}
 
 if [ $# -ne 1 ]; then
 	cat <<EOF
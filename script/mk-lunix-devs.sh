@@ -6,9 +6,12 @@ mknod /dev/ttyS1 c 4 65
 mknod /dev/ttyS2 c 4 66
 mknod /dev/ttyS3 c 4 67
 
-# Lunix:TNG nodes: 16 sensors, each has 3 nodes.
+# Lunix:TNG nodes: 16 sensors, each has 3 nodes, and 3 more for their aggregates.
 for sensor in $(seq 0 1 15); do
 	mknod /dev/lunix$sensor-batt c 60 $[$sensor * 8 + 0]
 	mknod /dev/lunix$sensor-temp c 60 $[$sensor * 8 + 1]
 	mknod /dev/lunix$sensor-light c 60 $[$sensor * 8 + 2]
+	mknod /dev/lunix$sensor-batt-agg c 60 $[$sensor * 8 + 3]
+	mknod /dev/lunix$sensor-temp-agg c 60 $[$sensor * 8 + 4]
+	mknod /dev/lunix$sensor-light-agg c 60 $[$sensor * 8 + 5]
 done